@@ -17,6 +17,7 @@
 #include <linux/bpf.h>
 #include <linux/perf_event.h>
 #include <unistd.h>
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <exception>
@@ -40,6 +41,9 @@
 #include "table_storage.h"
 #include "usdt.h"
 
+#include <bpf/btf.h>
+#include <bpf/libbpf.h>
+
 #include "BPF.h"
 
 namespace {
@@ -192,6 +196,18 @@ StatusTuple BPF::detach_all() {
     delete it.second;
   }
 
+  if (poll_fd_ >= 0) {
+    close(poll_fd_);
+    poll_fd_ = -1;
+    poll_events_.clear();
+  }
+
+  if (ringbuf_) {
+    bpf_free_ringbuf(ringbuf_);
+    ringbuf_ = nullptr;
+    ring_buffers_.clear();
+  }
+
   for (auto& it : perf_event_arrays_) {
     auto res = it.second->close_all_cpu();
     if (!res.ok()) {
@@ -648,6 +664,13 @@ StatusTuple BPF::open_perf_buffer(const std::string& name,
     return StatusTuple(-1, "open_perf_buffer page_cnt must be a power of two");
   auto table = perf_buffers_[name];
   TRY2(table->open_all_cpu(cb, lost_cb, cb_cookie, page_cnt));
+  for (auto& reader : table->cpu_readers()) {
+    auto res = add_poll_fd(perf_reader_fd(reader.second), reader.second);
+    if (!res.ok()) {
+      close_perf_buffer(name);
+      return res;
+    }
+  }
   return StatusTuple::OK();
 }
 
@@ -655,6 +678,10 @@ StatusTuple BPF::close_perf_buffer(const std::string& name) {
   auto it = perf_buffers_.find(name);
   if (it == perf_buffers_.end())
     return StatusTuple(-1, "Perf buffer for %s not open", name.c_str());
+  if (poll_fd_ >= 0) {
+    for (auto& reader : it->second->cpu_readers())
+      epoll_ctl(poll_fd_, EPOLL_CTL_DEL, perf_reader_fd(reader.second), nullptr);
+  }
   TRY2(it->second->close_all_cpu());
   return StatusTuple::OK();
 }
@@ -671,13 +698,624 @@ int BPF::poll_perf_buffer(const std::string& name, int timeout_ms) {
   return it->second->poll(timeout_ms);
 }
 
-size_t BPF:: get_num_functions() {return bpf_module_->num_functions();}
+StatusTuple BPF::open_ring_buffer(const std::string& name,
+                                  ring_buffer_sample_fn cb, void* cb_cookie) {
+  if (ring_buffers_.find(name) != ring_buffers_.end())
+    return StatusTuple(-1, "Ring buffer %s already open", name.c_str());
+  TableStorage::iterator it;
+  if (!bpf_module_->table_storage().Find(Path({bpf_module_->id(), name}), it))
+    return StatusTuple(-1, "open_ring_buffer: unable to find table_storage %s",
+                       name.c_str());
+  if (it->second.type != BPF_MAP_TYPE_RINGBUF)
+    return StatusTuple(-1, "Table '%s' is not a ring buffer", name.c_str());
+
+  int map_fd = it->second.fd;
+  if (!ringbuf_) {
+    ringbuf_ = static_cast<struct ring_buffer*>(
+        bpf_new_ringbuf(map_fd, cb, cb_cookie));
+    if (!ringbuf_)
+      return StatusTuple(-1, "Unable to create ring buffer for %s: %s",
+                         name.c_str(), std::strerror(errno));
+  } else if (bpf_add_ringbuf(ringbuf_, map_fd, cb, cb_cookie) < 0) {
+    return StatusTuple(-1, "Unable to add ring buffer %s: %s", name.c_str(),
+                       std::strerror(errno));
+  }
+  ring_buffers_[name] = map_fd;
+  // libbpf consumes every ring of the manager at once, so all ring buffers
+  // share the nullptr tag in the epoll set
+  return add_poll_fd(map_fd, nullptr);
+}
+
+int BPF::poll_ring_buffer(int timeout_ms) {
+  if (!ringbuf_)
+    return -1;
+  return bpf_poll_ringbuf(ringbuf_, timeout_ms);
+}
+
+int BPF::consume_ring_buffer() {
+  if (!ringbuf_)
+    return -1;
+  return bpf_consume_ringbuf(ringbuf_);
+}
+
+StatusTuple BPF::add_poll_fd(int fd, void* ptr) {
+  if (poll_fd_ < 0) {
+    poll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (poll_fd_ < 0)
+      return StatusTuple(-1, "Unable to create epoll instance: %s",
+                         std::strerror(errno));
+  }
+
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.ptr = ptr;
+  if (epoll_ctl(poll_fd_, EPOLL_CTL_ADD, fd, &event) != 0)
+    return StatusTuple(-1, "Unable to add FD %d to epoll: %s", fd,
+                       std::strerror(errno));
+  poll_events_.resize(poll_events_.size() + 1);
+  return StatusTuple::OK();
+}
+
+int BPF::poll_buffers(int timeout_ms) {
+  if (poll_fd_ < 0)
+    return -1;
+  int cnt = epoll_wait(poll_fd_, poll_events_.data(), poll_events_.size(),
+                       timeout_ms);
+  if (cnt < 0)
+    return errno == EINTR ? 0 : -1;
+
+  bool ringbuf_ready = false;
+  for (int i = 0; i < cnt; i++) {
+    if (poll_events_[i].data.ptr)
+      perf_reader_event_read(
+          static_cast<perf_reader*>(poll_events_[i].data.ptr));
+    else
+      ringbuf_ready = true;
+  }
+  if (ringbuf_ready && bpf_consume_ringbuf(ringbuf_) < 0)
+    return -1;
+  return cnt;
+}
+
+size_t BPF:: get_num_functions() {
+  if (from_image_) return image_funcs_.size();
+  if (from_object_) return object_progs_.size();
+  return bpf_module_->num_functions();
+}
 
 const char *BPF::get_function_name(size_t id) {
+  if (from_image_)
+    return id < image_funcs_.size() ? image_funcs_[id].first.c_str() : nullptr;
+  if (from_object_)
+    return id < object_progs_.size() ? object_progs_[id].first.c_str() : nullptr;
   if (!bpf_module_) return nullptr;
   return bpf_module_->function_name(id);
 }
 
+const TableDesc *BPF::get_table_desc(const std::string& name) {
+  TableStorage::iterator it;
+  if (bpf_module_ &&
+      bpf_module_->table_storage().Find(Path({bpf_module_->id(), name}), it))
+    return &it->second;
+  return nullptr;
+}
+
+std::vector<std::string> BPF::get_perf_event_fields(const std::string& name) {
+  std::vector<std::string> fields;
+  // Objects carry no record of perf_submit() layouts
+  if (from_object_) return fields;
+  if (from_image_) {
+    auto it = image_perf_fields_.find(name);
+    if (it != image_perf_fields_.end()) fields = it->second;
+    return fields;
+  }
+  if (!bpf_module_) return fields;
+  size_t num_fields = bpf_module_->perf_event_fields(name.c_str());
+  for (size_t i = 0; i < num_fields; i++) {
+    const char *field = bpf_module_->perf_event_field(name.c_str(), i);
+    if (field) fields.push_back(field);
+  }
+  return fields;
+}
+
+/*php add*/
+namespace {
+
+const char image_magic[8] = {'P', 'H', 'P', 'E', 'B', 'P', 'F', '1'};
+
+void image_put_u64(std::string& out, uint64_t v) {
+  out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+void image_put_str(std::string& out, const std::string& str) {
+  image_put_u64(out, str.size());
+  out += str;
+}
+
+struct ImageReader {
+  const std::string& data;
+  size_t pos;
+
+  bool u64(uint64_t& v) {
+    if (data.size() - pos < sizeof(v))
+      return false;
+    memcpy(&v, data.data() + pos, sizeof(v));
+    pos += sizeof(v);
+    return true;
+  }
+
+  bool str(std::string& str) {
+    uint64_t len;
+    if (!u64(len) || data.size() - pos < len)
+      return false;
+    str.assign(data, pos, len);
+    pos += len;
+    return true;
+  }
+};
+
+// The string converters of a table are generated by the compiler, tables
+// that did not go through it report an error instead
+void set_no_converters(TableDesc& desc) {
+  desc.key_sscanf = desc.leaf_sscanf = [](const char*, void*) {
+    return StatusTuple(-1, "sscanf is not available without the compiler");
+  };
+  desc.key_snprintf = desc.leaf_snprintf = [](char*, size_t, const void*) {
+    return StatusTuple(-1, "snprintf is not available without the compiler");
+  };
+}
+
+// Map types created from their layout alone; anything needing BTF or an
+// inner map, or shared with other programs, is left to a full compile
+bool image_map_type_supported(int type) {
+  switch (type) {
+  case BPF_MAP_TYPE_HASH:
+  case BPF_MAP_TYPE_ARRAY:
+  case BPF_MAP_TYPE_PROG_ARRAY:
+  case BPF_MAP_TYPE_PERF_EVENT_ARRAY:
+  case BPF_MAP_TYPE_PERCPU_HASH:
+  case BPF_MAP_TYPE_PERCPU_ARRAY:
+  case BPF_MAP_TYPE_STACK_TRACE:
+  case BPF_MAP_TYPE_CGROUP_ARRAY:
+  case BPF_MAP_TYPE_LRU_HASH:
+  case BPF_MAP_TYPE_LRU_PERCPU_HASH:
+  case BPF_MAP_TYPE_LPM_TRIE:
+  case BPF_MAP_TYPE_QUEUE:
+  case BPF_MAP_TYPE_STACK:
+  case BPF_MAP_TYPE_RINGBUF:
+    return true;
+  default:
+    return false;
+  }
+}
+
+}  // namespace
+
+/*php add*/
+StatusTuple BPF::save_image(std::string& image) {
+  if (from_image_ || from_object_)
+    return StatusTuple(-1, "Program was not compiled from source");
+  if (!usdt_.empty())
+    return StatusTuple(-1, "Programs with USDT probes can't be saved");
+
+  image.assign(image_magic, sizeof(image_magic));
+  const char* license = bpf_module_->license();
+  image_put_str(image, license ? license : "GPL");
+  image_put_u64(image, bpf_module_->kern_version());
+
+  size_t num_funcs = bpf_module_->num_functions();
+  image_put_u64(image, num_funcs);
+  for (size_t i = 0; i < num_funcs; i++) {
+    const char* name = bpf_module_->function_name(i);
+    uint8_t* start = bpf_module_->function_start(i);
+    if (!name || !start)
+      return StatusTuple(-1, "Can't find function %zu", i);
+    image_put_str(image, name);
+    image_put_str(image, std::string(reinterpret_cast<const char*>(start),
+                                     bpf_module_->function_size(i)));
+  }
+
+  size_t num_tables = bpf_module_->num_tables();
+  image_put_u64(image, num_tables);
+  for (size_t i = 0; i < num_tables; i++) {
+    const char* name = bpf_module_->table_name(i);
+    const TableDesc* desc = name ? get_table_desc(name) : nullptr;
+    if (!desc)
+      return StatusTuple(-1, "Can't find table %zu", i);
+    if (desc->is_shared || desc->is_extern)
+      return StatusTuple(-1, "Table %s is shared with other programs", name);
+    if (!image_map_type_supported(desc->type))
+      return StatusTuple(-1, "Table %s has unsupported type %d", name, desc->type);
+
+    image_put_str(image, desc->name);
+    image_put_u64(image, (uint64_t) desc->type);
+    image_put_u64(image, desc->key_size);
+    image_put_u64(image, desc->leaf_size);
+    image_put_u64(image, desc->max_entries);
+    image_put_u64(image, (uint64_t) desc->flags);
+    image_put_u64(image, (uint64_t) (int) desc->fd);
+    image_put_str(image, desc->key_desc);
+    image_put_str(image, desc->leaf_desc);
+    auto fields = get_perf_event_fields(desc->name);
+    image_put_u64(image, fields.size());
+    for (const auto& field : fields)
+      image_put_str(image, field);
+  }
+  return StatusTuple::OK();
+}
+
+/*php add*/
+StatusTuple BPF::init_image(const std::string& image) {
+  if (from_image_ || from_object_ || !funcs_.empty())
+    return StatusTuple(-1, "Program already initialized");
+  if (image.size() < sizeof(image_magic) ||
+      memcmp(image.data(), image_magic, sizeof(image_magic)) != 0)
+    return StatusTuple(-1, "Not a program image");
+
+  ImageReader in{image, sizeof(image_magic)};
+  uint64_t kern_version, num_funcs, num_tables;
+  std::string license;
+  std::vector<std::pair<std::string, std::string>> funcs;
+  if (!in.str(license) || !in.u64(kern_version) || !in.u64(num_funcs))
+    return StatusTuple(-1, "Truncated program image");
+  for (uint64_t i = 0; i < num_funcs; i++) {
+    funcs.emplace_back();
+    if (!in.str(funcs.back().first) || !in.str(funcs.back().second) ||
+        funcs.back().second.size() % sizeof(struct bpf_insn) != 0)
+      return StatusTuple(-1, "Truncated program image");
+  }
+
+  // Tables go into the storage under this module, so the usual lookups and
+  // the module destructor see them like compiled ones
+  std::map<int, int> fds;
+  std::vector<std::string> created;
+  std::map<std::string, std::vector<std::string>> perf_fields;
+  auto fail = [&](const StatusTuple& res) {
+    for (const auto& name : created)
+      bpf_module_->table_storage().Delete(Path({bpf_module_->id(), name}));
+    return res;
+  };
+  if (!in.u64(num_tables))
+    return StatusTuple(-1, "Truncated program image");
+  for (uint64_t i = 0; i < num_tables; i++) {
+    std::string name, key_desc, leaf_desc;
+    uint64_t type, key_size, leaf_size, max_entries, flags, old_fd, num_fields;
+    if (!in.str(name) || !in.u64(type) || !in.u64(key_size) ||
+        !in.u64(leaf_size) || !in.u64(max_entries) || !in.u64(flags) ||
+        !in.u64(old_fd) || !in.str(key_desc) || !in.str(leaf_desc) ||
+        !in.u64(num_fields))
+      return fail(StatusTuple(-1, "Truncated program image"));
+    auto& fields = perf_fields[name];
+    for (uint64_t f = 0; f < num_fields; f++) {
+      fields.emplace_back();
+      if (!in.str(fields.back()))
+        return fail(StatusTuple(-1, "Truncated program image"));
+    }
+    if (!image_map_type_supported((int) type))
+      return fail(StatusTuple(-1, "Table %s has unsupported type %d", name.c_str(), (int) type));
+
+    int fd = bcc_create_map((enum bpf_map_type) type, name.c_str(), (int) key_size,
+                            (int) leaf_size, (int) max_entries, (int) flags);
+    if (fd < 0)
+      return fail(StatusTuple(-1, "Failed to create table %s: %s", name.c_str(),
+                              std::strerror(errno)));
+
+    TableDesc desc(name, FileDesc(fd), (int) type, key_size, leaf_size,
+                   max_entries, (int) flags);
+    desc.key_desc = key_desc;
+    desc.leaf_desc = leaf_desc;
+    desc.is_shared = false;
+    desc.is_extern = false;
+    set_no_converters(desc);
+    fds[(int) old_fd] = fd;
+    if (!bpf_module_->table_storage().Insert(Path({bpf_module_->id(), name}),
+                                             std::move(desc)))
+      return fail(StatusTuple(-1, "Can't register table %s", name.c_str()));
+    created.push_back(name);
+  }
+
+  // Map references are ld_imm64 instructions carrying the fd of the table
+  // in the process that compiled the program
+  for (auto& func : funcs) {
+    auto insns = reinterpret_cast<struct bpf_insn*>(&func.second[0]);
+    size_t count = func.second.size() / sizeof(struct bpf_insn);
+    for (size_t i = 0; i < count; i++) {
+      if (insns[i].code != (BPF_LD | BPF_DW | BPF_IMM))
+        continue;
+      if (insns[i].src_reg == BPF_PSEUDO_MAP_FD) {
+        auto it = fds.find(insns[i].imm);
+        if (it == fds.end())
+          return fail(StatusTuple(-1, "Function %s uses an unknown table",
+                                  func.first.c_str()));
+        insns[i].imm = it->second;
+      } else if (insns[i].src_reg != 0) {
+        return fail(StatusTuple(-1, "Function %s has unsupported relocations",
+                                func.first.c_str()));
+      }
+      i++;
+    }
+  }
+
+  image_funcs_ = std::move(funcs);
+  image_license_ = license;
+  image_kern_version_ = (unsigned) kern_version;
+  image_perf_fields_ = std::move(perf_fields);
+  from_image_ = true;
+  return StatusTuple::OK();
+}
+
+/*php add*/
+namespace {
+
+std::string json_quote(const std::string& str) {
+  return "\"" + str + "\"";
+}
+
+const char* btf_int_name(size_t size, bool is_signed) {
+  switch (size) {
+  case 1: return is_signed ? "signed char" : "unsigned char";
+  case 2: return is_signed ? "short" : "unsigned short";
+  case 4: return is_signed ? "int" : "unsigned int";
+  case 8: return is_signed ? "long long" : "unsigned long long";
+  case 16: return is_signed ? "__int128" : "unsigned __int128";
+  default: return nullptr;
+  }
+}
+
+// Element type of a possibly multi-dimensional array, dims receives the sizes
+int btf_array_elem(const struct btf* btf, uint32_t id, std::vector<uint32_t>& dims) {
+  for (;;) {
+    int resolved = btf__resolve_type(btf, id);
+    const struct btf_type* t = resolved < 0 ? nullptr : btf__type_by_id(btf, resolved);
+    if (!t || btf_kind(t) != BTF_KIND_ARRAY)
+      return resolved;
+    dims.push_back(btf_array(t)->nelems);
+    id = btf_array(t)->type;
+  }
+}
+
+bool btf_type_desc(const struct btf* btf, uint32_t id, const std::string& name,
+                   std::string& out, int depth);
+
+// Structs are described as packed with explicit padding, so the layout
+// follows the BTF member offsets instead of being recomputed
+bool btf_record_desc(const struct btf* btf, const struct btf_type* t,
+                     const std::string& name, std::string& out, int depth) {
+  bool is_union = btf_kind(t) == BTF_KIND_UNION;
+  size_t pos = 0, pads = 0;
+  std::string fields;
+  auto sep = [&]() {
+    if (!fields.empty())
+      fields += ", ";
+  };
+  auto pad_bits = [&](size_t bits) {
+    sep();
+    fields += "[\"__pad_" + std::to_string(pads++) + "\", \"unsigned long long\", " +
+              std::to_string(bits) + "]";
+  };
+  auto pad_bytes = [&](size_t bytes) {
+    sep();
+    fields += "[\"__pad_" + std::to_string(pads++) + "\", \"char\", [" +
+              std::to_string(bytes) + "]]";
+  };
+
+  size_t max_size = 0;
+  const struct btf_member* m = btf_members(t);
+  for (uint16_t i = 0; i < btf_vlen(t); i++, m++) {
+    size_t bit_off = btf_member_bit_offset(t, i);
+    size_t bits = btf_member_bitfield_size(t, i);
+    const char* mname = btf__name_by_offset(btf, m->name_off);
+    std::string field = mname && *mname ? mname : "__anon_" + std::to_string(i);
+    int size = btf__resolve_size(btf, m->type);
+    if (size < 0)
+      return false;
+    max_size = std::max(max_size, (size_t) size);
+
+    if (!is_union) {
+      if (bit_off < pos || (bits == 0 && bit_off % 8 != 0))
+        return false;
+      if (bit_off > pos && pos % 8 != 0) {
+        size_t n = std::min(bit_off - pos, 8 - pos % 8);
+        pad_bits(n);
+        pos += n;
+      }
+      if (bit_off - pos >= 8) {
+        pad_bytes((bit_off - pos) / 8);
+        pos += (bit_off - pos) / 8 * 8;
+      }
+      if (bit_off > pos)
+        pad_bits(bit_off - pos);
+      pos = bit_off + (bits ? bits : (size_t) size * 8);
+    }
+
+    std::vector<uint32_t> dims;
+    int elem = bits ? btf__resolve_type(btf, m->type) : btf_array_elem(btf, m->type, dims);
+    std::string type;
+    if (elem < 0 || !btf_type_desc(btf, elem, field, type, depth + 1))
+      return false;
+    sep();
+    if (type[0] == '[') {
+      if (bits)
+        return false;
+      // A nested record entry is the record descriptor itself
+      fields += dims.empty() ? type : "[" + json_quote(field) + ", " + type + ", [";
+    } else {
+      fields += "[" + json_quote(field) + ", " + type;
+      if (bits)
+        fields += ", " + std::to_string(bits);
+      else if (!dims.empty())
+        fields += ", [";
+    }
+    if (!dims.empty()) {
+      for (size_t d = 0; d < dims.size(); d++)
+        fields += (d ? ", " : "") + std::to_string(dims[d]);
+      fields += "]";
+    }
+    if (type[0] != '[' || !dims.empty())
+      fields += "]";
+  }
+
+  if (is_union && max_size < t->size)
+    pad_bytes(t->size);
+  else if (!is_union && pos < (size_t) t->size * 8) {
+    if (pos % 8 != 0) {
+      size_t n = 8 - pos % 8;
+      pad_bits(n);
+      pos += n;
+    }
+    if (pos < (size_t) t->size * 8)
+      pad_bytes(t->size - pos / 8);
+  }
+
+  out += "[" + json_quote(name) + ", [" + fields + "], " +
+         (is_union ? "\"union\"" : "\"struct_packed\"") + "]";
+  return true;
+}
+
+bool btf_type_desc(const struct btf* btf, uint32_t id, const std::string& name,
+                   std::string& out, int depth) {
+  int resolved = btf__resolve_type(btf, id);
+  const struct btf_type* t = resolved < 0 ? nullptr : btf__type_by_id(btf, resolved);
+  if (!t || depth > 32)
+    return false;
+
+  switch (btf_kind(t)) {
+  case BTF_KIND_INT: {
+    const char* tname = btf__name_by_offset(btf, t->name_off);
+    uint8_t encoding = btf_int_encoding(t);
+    if (encoding & BTF_INT_BOOL) {
+      out += json_quote("_Bool");
+      return true;
+    }
+    if (t->size == 1 && ((encoding & BTF_INT_CHAR) || (tname && strcmp(tname, "char") == 0))) {
+      out += json_quote("char");
+      return true;
+    }
+    const char* int_name = btf_int_name(t->size, encoding & BTF_INT_SIGNED);
+    if (!int_name)
+      return false;
+    out += json_quote(int_name);
+    return true;
+  }
+  case BTF_KIND_ENUM: {
+    const char* int_name = btf_int_name(t->size, false);
+    if (!int_name)
+      return false;
+    out += json_quote(int_name);
+    return true;
+  }
+  case BTF_KIND_PTR:
+    // BPF pointers are 64-bit whatever the host
+    out += json_quote("unsigned long long");
+    return true;
+  case BTF_KIND_FLOAT:
+    if (t->size != 4 && t->size != 8)
+      return false;
+    out += json_quote(t->size == 4 ? "float" : "double");
+    return true;
+  case BTF_KIND_STRUCT:
+  case BTF_KIND_UNION: {
+    const char* tname = btf__name_by_offset(btf, t->name_off);
+    return btf_record_desc(btf, t, name.empty() && tname ? tname : name, out, depth);
+  }
+  default:
+    return false;
+  }
+}
+
+// Table descriptor in the format bcc generates, so schemas derive the same
+// way for objects. Without BTF an integer of the right size stands in.
+std::string btf_map_desc(const struct btf* btf, uint32_t id, size_t size) {
+  std::string out;
+  std::vector<uint32_t> dims;
+  if (btf && id && btf_array_elem(btf, id, dims) >= 0 && dims.empty() &&
+      btf_type_desc(btf, id, "", out, 0))
+    return out;
+  const char* int_name = btf_int_name(size, false);
+  return int_name ? json_quote(int_name) : "";
+}
+
+}  // namespace
+
+/*php add*/
+StatusTuple BPF::init_object(const std::string& path) {
+  if (from_image_ || from_object_ || !funcs_.empty())
+    return StatusTuple(-1, "Program already initialized");
+
+  struct bpf_object* obj = bpf_object__open_file(path.c_str(), nullptr);
+  long err = libbpf_get_error(obj);
+  if (err)
+    return StatusTuple(-1, "Unable to open BPF object %s: %s", path.c_str(),
+                       std::strerror((int) -err));
+  // Tables and programs keep dups of their fds, the object itself goes away
+  std::unique_ptr<struct bpf_object, void (*)(struct bpf_object*)> guard(
+      obj, bpf_object__close);
+  err = bpf_object__load(obj);
+  if (err)
+    return StatusTuple(-1, "Unable to load BPF object %s: %s", path.c_str(),
+                       std::strerror((int) (err < 0 ? -err : err)));
+
+  std::vector<std::string> created;
+  auto fail = [&](const StatusTuple& res) {
+    for (const auto& name : created)
+      bpf_module_->table_storage().Delete(Path({bpf_module_->id(), name}));
+    for (auto& it : funcs_)
+      close(it.second);
+    funcs_.clear();
+    object_progs_.clear();
+    return res;
+  };
+
+  const struct btf* btf = bpf_object__btf(obj);
+  struct bpf_map* map;
+  bpf_object__for_each_map(map, obj) {
+    const char* name = bpf_map__name(map);
+    if (bpf_map__fd(map) < 0)
+      continue;
+    int fd = dup(bpf_map__fd(map));
+    if (fd < 0)
+      return fail(StatusTuple(-1, "Unable to dup fd of map %s: %s", name,
+                              std::strerror(errno)));
+    TableDesc desc(name, FileDesc(fd), (int) bpf_map__type(map),
+                   bpf_map__key_size(map), bpf_map__value_size(map),
+                   bpf_map__max_entries(map), (int) bpf_map__map_flags(map));
+    desc.key_desc = btf_map_desc(btf, bpf_map__btf_key_type_id(map), desc.key_size);
+    desc.leaf_desc = btf_map_desc(btf, bpf_map__btf_value_type_id(map), desc.leaf_size);
+    desc.is_shared = false;
+    desc.is_extern = false;
+    set_no_converters(desc);
+    if (!bpf_module_->table_storage().Insert(Path({bpf_module_->id(), name}),
+                                             std::move(desc)))
+      return fail(StatusTuple(-1, "Can't register table %s", name));
+    created.push_back(name);
+  }
+
+  struct bpf_program* prog;
+  bpf_object__for_each_program(prog, obj) {
+    // Programs with autoload turned off have no fd
+    if (bpf_program__fd(prog) < 0)
+      continue;
+    const char* name = bpf_program__name(prog);
+    int fd = dup(bpf_program__fd(prog));
+    if (fd < 0)
+      return fail(StatusTuple(-1, "Unable to dup fd of program %s: %s", name,
+                              std::strerror(errno)));
+    funcs_[name] = fd;
+    const char* section = bpf_program__section_name(prog);
+    object_progs_.emplace_back(name, section ? section : "");
+  }
+
+  from_object_ = true;
+  return StatusTuple::OK();
+}
+
+/*php add*/
+const char *BPF::get_function_section(size_t id) {
+  if (!from_object_ || id >= object_progs_.size())
+    return nullptr;
+  return object_progs_[id].second.c_str();
+}
+
 StatusTuple BPF::load_func(const std::string& func_name, bpf_prog_type type,
                            int& fd, unsigned flags, bpf_attach_type expected_attach_type) {
   if (funcs_.find(func_name) != funcs_.end()) {
@@ -685,11 +1323,29 @@ StatusTuple BPF::load_func(const std::string& func_name, bpf_prog_type type,
     return StatusTuple::OK();
   }
 
-  uint8_t* func_start = bpf_module_->function_start(func_name);
+  uint8_t* func_start = nullptr;
+  size_t func_size = 0;
+  /*php add*/
+  if (from_object_) {
+    // Everything in the object was loaded by init_object()
+    return StatusTuple(-1, "Can't find function %s in the object",
+                       func_name.c_str());
+  } else if (from_image_) {
+    for (auto& f : image_funcs_) {
+      if (f.first == func_name) {
+        func_start = reinterpret_cast<uint8_t*>(&f.second[0]);
+        func_size = f.second.size();
+        break;
+      }
+    }
+  } else {
+    func_start = bpf_module_->function_start(func_name);
+    if (func_start)
+      func_size = bpf_module_->function_size(func_name);
+  }
   if (!func_start)
     return StatusTuple(-1, "Can't find start of function %s",
                        func_name.c_str());
-  size_t func_size = bpf_module_->function_size(func_name);
 
   int log_level = 0;
   if (flag_ & DEBUG_BPF_REGISTER_STATE)
@@ -699,16 +1355,20 @@ StatusTuple BPF::load_func(const std::string& func_name, bpf_prog_type type,
 
   fd = bpf_module_->bcc_func_load(type, func_name.c_str(),
                      reinterpret_cast<struct bpf_insn*>(func_start), func_size,
-                     bpf_module_->license(), bpf_module_->kern_version(),
+                     from_image_ ? image_license_.c_str() : bpf_module_->license(),
+                     from_image_ ? image_kern_version_ : bpf_module_->kern_version(),
                      log_level, nullptr, 0, nullptr, flags, expected_attach_type);
 
   if (fd < 0)
     return StatusTuple(-1, "Failed to load %s: %d", func_name.c_str(), fd);
 
-  int ret = bpf_module_->annotate_prog_tag(
-      func_name, fd, reinterpret_cast<struct bpf_insn*>(func_start), func_size);
-  if (ret < 0)
-    fprintf(stderr, "WARNING: cannot get prog tag, ignore saving source with program tag\n");
+  // Source is not kept in an image, there is nothing to annotate the tag with
+  if (!from_image_) {
+    int ret = bpf_module_->annotate_prog_tag(
+        func_name, fd, reinterpret_cast<struct bpf_insn*>(func_start), func_size);
+    if (ret < 0)
+      fprintf(stderr, "WARNING: cannot get prog tag, ignore saving source with program tag\n");
+  }
   funcs_[func_name] = fd;
   return StatusTuple::OK();
 }
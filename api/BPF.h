@@ -189,6 +189,32 @@ class BPF {
 	/*php add*/
 	const char *get_function_name(size_t id);
 
+	/*php add*/
+	const TableDesc *get_table_desc(const std::string& name);
+
+	/*php add*/
+	std::vector<std::string> get_perf_event_fields(const std::string& name);
+
+	/*php add*/
+	// Serialize the program loaded by init(): bytecode, license, kernel
+	// version, table layouts and perf event fields.
+	StatusTuple save_image(std::string& image);
+
+	/*php add*/
+	// Load a program from save_image() output without running clang/LLVM.
+	// Tables are created anew and map references in the bytecode relocated.
+	StatusTuple init_image(const std::string& image);
+
+	/*php add*/
+	// Load a compiled BPF ELF object (libbpf CO-RE) instead of source.
+	// Maps become tables, with descriptors generated from their BTF, and
+	// every program is loaded up front.
+	StatusTuple init_object(const std::string& path);
+
+	/*php add*/
+	// ELF section of a program loaded by init_object(), nullptr otherwise
+	const char *get_function_section(size_t id);
+
 
 	BPFTable get_table(const std::string& name) {
     TableStorage::iterator it;
@@ -340,6 +366,28 @@ class BPF {
   //   number of CPUs that have new data, otherwise.
   int poll_perf_buffer(const std::string& name, int timeout_ms = -1);
 
+  /*php add*/
+  // Open a Ring Buffer of given name, providing callback and callback cookie
+  // to use when polling. All Ring Buffers of this BPF instance are attached to
+  // one libbpf ring_buffer manager, which is freed on destruction.
+  StatusTuple open_ring_buffer(const std::string& name,
+                               ring_buffer_sample_fn cb,
+                               void* cb_cookie = nullptr);
+  // Poll all opened Ring Buffers with given timeout. Returns number of records
+  // consumed, or negative on error or if no Ring Buffer is open.
+  int poll_ring_buffer(int timeout_ms = -1);
+  // Consume all available records of opened Ring Buffers without waiting.
+  int consume_ring_buffer();
+
+  /*php add*/
+  // Wait on one epoll set shared by all opened Perf Buffers and Ring Buffers,
+  // and read every buffer that became ready, using the callbacks provided
+  // when opening. Returns:
+  //   -1 on error or if no buffer is open;
+  //   0, if no data was available before timeout or the wait was interrupted;
+  //   number of ready Perf Buffer CPUs and Ring Buffers, otherwise.
+  int poll_buffers(int timeout_ms = -1);
+
   StatusTuple load_func(const std::string& func_name, enum bpf_prog_type type,
                         int& fd, unsigned flags = 0, enum bpf_attach_type = (bpf_attach_type) -1);
   StatusTuple unload_func(const std::string& func_name);
@@ -405,6 +453,8 @@ class BPF {
 
   void init_fail_reset();
 
+  StatusTuple add_poll_fd(int fd, void* ptr);
+
   int flag_;
 
   void *bsymcache_;
@@ -415,6 +465,19 @@ class BPF {
 
   std::map<std::string, int> funcs_;
 
+  /*php add*/
+  // Program state restored by init_image(), the module itself holds none
+  bool from_image_ = false;
+  std::vector<std::pair<std::string, std::string>> image_funcs_;
+  std::string image_license_;
+  unsigned image_kern_version_ = 0;
+  std::map<std::string, std::vector<std::string>> image_perf_fields_;
+
+  /*php add*/
+  // Programs loaded by init_object() as name and ELF section, their fds are in funcs_
+  bool from_object_ = false;
+  std::vector<std::pair<std::string, std::string>> object_progs_;
+
   std::vector<USDT> usdt_;
   std::string all_bpf_program_;
 
@@ -423,6 +486,11 @@ class BPF {
   std::map<std::string, open_probe_t> tracepoints_;
   std::map<std::string, open_probe_t> raw_tracepoints_;
   std::map<std::string, BPFPerfBuffer*> perf_buffers_;
+  struct ring_buffer* ringbuf_ = nullptr;
+  std::map<std::string, int> ring_buffers_;
+  // Shared epoll set: perf readers are tagged with their reader, ring buffers with nullptr
+  int poll_fd_ = -1;
+  std::vector<epoll_event> poll_events_;
   std::map<std::string, BPFPerfEventArray*> perf_event_arrays_;
   std::map<std::pair<uint32_t, uint32_t>, open_probe_t> perf_events_;
 };
@@ -19,8 +19,10 @@
 #include <linux/perf_event.h>
 #include <sys/epoll.h>
 #include <unistd.h>
+#include <algorithm>
 #include <cerrno>
 #include <cinttypes>
+#include <cstdio>
 #include <cstdint>
 #include <cstring>
 #include <iostream>
@@ -248,82 +250,343 @@ StatusTuple BPFTable::get_table_offline(
 
 StatusTuple BPFTable::get_table_offline_ptr(
 		std::vector<std::pair<std::vector<char>, std::vector<char>>> &res) {
-	StatusTuple r(0);
-	int err;
-
-	auto key = std::unique_ptr<void, decltype(::free)*>(::malloc(desc.key_size),
-	                                                    ::free);
-	auto value = std::unique_ptr<void, decltype(::free)*>(::malloc(desc.leaf_size),
-	                                                      ::free);
-	std::string key_str;
-	std::string value_str;
-
-	if (desc.type == BPF_MAP_TYPE_ARRAY ||
-	    desc.type == BPF_MAP_TYPE_PROG_ARRAY ||
-	    desc.type == BPF_MAP_TYPE_PERF_EVENT_ARRAY ||
-	    desc.type == BPF_MAP_TYPE_PERCPU_ARRAY ||
-	    desc.type == BPF_MAP_TYPE_CGROUP_ARRAY ||
-	    desc.type == BPF_MAP_TYPE_ARRAY_OF_MAPS ||
-	    desc.type == BPF_MAP_TYPE_DEVMAP ||
-	    desc.type == BPF_MAP_TYPE_CPUMAP ||
-	    desc.type == BPF_MAP_TYPE_REUSEPORT_SOCKARRAY) {
-		// For arrays, just iterate over all indices
-		for (size_t i = 0; i < desc.max_entries; i++) {
-			err = bpf_lookup_elem(desc.fd, &i, value.get());
-			if (err < 0 && errno == ENOENT) {
-				// Element is not present, skip it
-				continue;
-			} else if (err < 0) {
-				// Other error, abort
-				return StatusTuple(-1, "Error looking up value: %s", std::strerror(errno));
-			}
-
-			r = key_to_string(&i, key_str);
-			if (!r.ok())
-				return r;
-
-			r = leaf_to_string(value.get(), value_str);
-			if (!r.ok())
-				return r;
-			std::vector<char> key_vec(desc.key_size);
-			std::vector<char> value_vec(desc.leaf_size);
-			std::memcpy(key_vec.data(), key.get(), desc.key_size);
-			std::memcpy(value_vec.data(), value.get(), desc.leaf_size);
-
-			res.emplace_back(key_vec, value_vec);
-		}
-	} else {
-		res.clear();
-		// For other maps, try to use the first() and next() interfaces
-		if (!this->first(key.get()))
-			return StatusTuple::OK();
-
-		while (true) {
-			if (!this->lookup(key.get(), value.get()))
-				break;
-			r = key_to_string(key.get(), key_str);
-			if (!r.ok())
-				return r;
-
-			r = leaf_to_string(value.get(), value_str);
-			if (!r.ok())
-				return r;
-
-
-			std::vector<char> key_vec(desc.key_size);
-			std::vector<char> value_vec(desc.leaf_size);
-			std::memcpy(key_vec.data(), key.get(), desc.key_size);
-			std::memcpy(value_vec.data(), value.get(), desc.leaf_size);
-
-			res.emplace_back(key_vec, value_vec);
-			if (!this->next(key.get(), key.get()))
-				break;
-		}
+	TableDump dump;
+	StatusTuple r = get_table_offline_raw(dump);
+	if (!r.ok())
+		return r;
+
+	res.clear();
+	res.reserve(dump.count);
+	for (size_t i = 0; i < dump.count; i++) {
+		res.emplace_back(std::vector<char>(dump.key(i), dump.key(i) + dump.key_size),
+		                 std::vector<char>(dump.value(i), dump.value(i) + dump.value_size));
 	}
 
 	return StatusTuple::OK();
 }
 
+/*php add*/
+bool BPFTable::is_percpu() {
+  return desc.type == BPF_MAP_TYPE_PERCPU_HASH ||
+         desc.type == BPF_MAP_TYPE_PERCPU_ARRAY ||
+         desc.type == BPF_MAP_TYPE_LRU_PERCPU_HASH ||
+         desc.type == BPF_MAP_TYPE_PERCPU_CGROUP_STORAGE;
+}
+
+/*php add*/
+bool BPFTable::is_array() {
+  return desc.type == BPF_MAP_TYPE_ARRAY ||
+         desc.type == BPF_MAP_TYPE_PROG_ARRAY ||
+         desc.type == BPF_MAP_TYPE_PERF_EVENT_ARRAY ||
+         desc.type == BPF_MAP_TYPE_PERCPU_ARRAY ||
+         desc.type == BPF_MAP_TYPE_CGROUP_ARRAY ||
+         desc.type == BPF_MAP_TYPE_ARRAY_OF_MAPS ||
+         desc.type == BPF_MAP_TYPE_DEVMAP ||
+         desc.type == BPF_MAP_TYPE_CPUMAP ||
+         desc.type == BPF_MAP_TYPE_REUSEPORT_SOCKARRAY;
+}
+
+/*php add*/
+size_t BPFTable::get_value_size() {
+  if (!is_percpu())
+    return desc.leaf_size;
+  return ((desc.leaf_size + 7) & ~static_cast<size_t>(7)) * get_possible_cpu_count();
+}
+
+/*php add*/
+void BPFTable::dump_reset(TableDump &dump) {
+  dump.key_size = desc.key_size;
+  dump.value_size = get_value_size();
+  dump.count = 0;
+  dump.keys.clear();
+  dump.values.clear();
+}
+
+/*php add*/
+void BPFTable::dump_reserve(TableDump &dump, size_t n) {
+  dump.keys.resize((dump.count + n) * dump.key_size);
+  dump.values.resize((dump.count + n) * dump.value_size);
+}
+
+/*php add*/
+void BPFTable::dump_shrink(TableDump &dump) {
+  dump.keys.resize(dump.count * dump.key_size);
+  dump.values.resize(dump.count * dump.value_size);
+}
+
+/*php add*/
+StatusTuple BPFTable::get_table_offline_raw(TableDump &dump) {
+  dump_reset(dump);
+
+  if (is_array()) {
+    // For arrays, just iterate over all indices
+    for (uint32_t i = 0; i < desc.max_entries; i++) {
+      dump_reserve(dump, 1);
+      std::memcpy(dump.key(dump.count), &i, std::min(sizeof(i), desc.key_size));
+      if (!this->lookup(dump.key(dump.count), dump.value(dump.count))) {
+        // Element is not present, skip it
+        if (errno == ENOENT)
+          continue;
+        dump_shrink(dump);
+        return StatusTuple(-1, "Error looking up value: %s", std::strerror(errno));
+      }
+      dump.count++;
+    }
+  } else {
+    // For other maps, walk the keys with first() and next(), writing each
+    // key straight into its slot and the following key into the next one
+    dump_reserve(dump, 1);
+    if (this->first(dump.key(0))) {
+      while (true) {
+        bool found = this->lookup(dump.key(dump.count), dump.value(dump.count));
+        dump_reserve(dump, 2);
+        bool more = this->next(dump.key(dump.count), dump.key(dump.count + 1));
+        if (found)
+          dump.count++;
+        else if (more)
+          // Deleted under us: reuse the slot for the next key
+          std::memcpy(dump.key(dump.count), dump.key(dump.count + 1), dump.key_size);
+        if (!more)
+          break;
+      }
+    }
+  }
+
+  dump_shrink(dump);
+  return StatusTuple::OK();
+}
+
+/*php add*/
+// Kernel-internal ENOTSUPP, returned by maps without batch support
+#ifndef ENOTSUPP
+#define ENOTSUPP 524
+#endif
+
+/*php add*/
+StatusTuple BPFTable::get_table_offline_batch(TableDump &dump, size_t batch_size) {
+  return batch_dump(dump, batch_size, false);
+}
+
+/*php add*/
+StatusTuple BPFTable::drain_table_batch(TableDump &dump, size_t batch_size) {
+  return batch_dump(dump, batch_size, true);
+}
+
+/*php add*/
+StatusTuple BPFTable::get_table_chunk(TableCursor &cursor, TableDump &dump, size_t batch_size) {
+  if (batch_size == 0)
+    batch_size = DEFAULT_BATCH_SIZE;
+  if (desc.max_entries > 0 && batch_size > desc.max_entries)
+    batch_size = desc.max_entries;
+
+  dump_reset(dump);
+  if (cursor.done)
+    return StatusTuple::OK();
+
+  if (cursor.batched) {
+    size_t token_size = std::max(desc.key_size, sizeof(uint32_t));
+    std::vector<char> out_batch(token_size);
+    cursor.token.resize(token_size);
+    while (true) {
+      dump_reserve(dump, batch_size);
+      uint32_t count = batch_size;
+      int err = bpf_lookup_batch(desc.fd,
+                                 cursor.started ? reinterpret_cast<uint32_t*>(cursor.token.data()) : nullptr,
+                                 reinterpret_cast<uint32_t*>(out_batch.data()),
+                                 dump.key(0), dump.value(0), &count);
+      int saved_errno = errno;
+      if (err < 0 && saved_errno == ENOSPC && count == 0) {
+        batch_size *= 2;
+        continue;
+      }
+      if (err < 0 && saved_errno != ENOENT) {
+        if (!cursor.started && (saved_errno == EINVAL || saved_errno == ENOTSUP ||
+                                saved_errno == ENOTSUPP)) {
+          cursor.batched = false;
+          break;
+        }
+        dump_shrink(dump);
+        return StatusTuple(-1, "Error looking up batch: %s", std::strerror(saved_errno));
+      }
+
+      dump.count = count;
+      cursor.started = true;
+      if (err < 0)
+        cursor.done = true;
+      else
+        cursor.token.swap(out_batch);
+      dump_shrink(dump);
+      return StatusTuple::OK();
+    }
+  }
+
+  if (is_array()) {
+    while (dump.count < batch_size && cursor.index < desc.max_entries) {
+      uint32_t i = cursor.index++;
+      dump_reserve(dump, 1);
+      std::memcpy(dump.key(dump.count), &i, std::min(sizeof(i), desc.key_size));
+      if (this->lookup(dump.key(dump.count), dump.value(dump.count)))
+        dump.count++;
+      else if (errno != ENOENT) {
+        dump_shrink(dump);
+        return StatusTuple(-1, "Error looking up value: %s", std::strerror(errno));
+      }
+    }
+    cursor.done = cursor.index >= desc.max_entries;
+  } else {
+    cursor.token.resize(desc.key_size);
+    while (dump.count < batch_size) {
+      dump_reserve(dump, 1);
+      bool more = cursor.started ? this->next(cursor.token.data(), dump.key(dump.count))
+                                 : this->first(dump.key(dump.count));
+      cursor.started = true;
+      if (!more) {
+        cursor.done = true;
+        break;
+      }
+      std::memcpy(cursor.token.data(), dump.key(dump.count), desc.key_size);
+      if (this->lookup(dump.key(dump.count), dump.value(dump.count)))
+        dump.count++;
+    }
+  }
+
+  dump_shrink(dump);
+  return StatusTuple::OK();
+}
+
+/*php add*/
+StatusTuple BPFTable::update_batch(void* keys, void* values, size_t count) {
+  char *k = static_cast<char*>(keys);
+  char *v = static_cast<char*>(values);
+  size_t value_size = get_value_size();
+  uint32_t n = count;
+
+  if (bpf_update_batch(desc.fd, keys, values, &n) >= 0)
+    return StatusTuple::OK();
+  if (n > 0 || (errno != EINVAL && errno != ENOTSUP && errno != ENOTSUPP))
+    return StatusTuple(-1, "Error updating batch: %s", std::strerror(errno));
+
+  for (size_t i = 0; i < count; i++) {
+    if (!update(k + i * desc.key_size, v + i * value_size))
+      return StatusTuple(-1, "Error updating value: %s", std::strerror(errno));
+  }
+  return StatusTuple::OK();
+}
+
+/*php add*/
+StatusTuple BPFTable::delete_batch(void* keys, size_t count, size_t& deleted) {
+  char *k = static_cast<char*>(keys);
+  size_t done = 0;
+  bool batched = true;
+
+  deleted = 0;
+  while (batched && done < count) {
+    uint32_t n = count - done;
+    int err = bpf_delete_batch(desc.fd, k + done * desc.key_size, &n);
+    int saved_errno = errno;
+    // Keys are deleted in order, n tells how far the kernel got
+    deleted += n;
+    done += n;
+    if (err >= 0)
+      break;
+    if (saved_errno == ENOENT) {
+      // Skip the missing key and carry on with the rest
+      done++;
+    } else if (done == 0 && (saved_errno == EINVAL || saved_errno == ENOTSUP ||
+                             saved_errno == ENOTSUPP)) {
+      batched = false;
+    } else {
+      return StatusTuple(-1, "Error deleting batch: %s", std::strerror(saved_errno));
+    }
+  }
+
+  for (; !batched && done < count; done++) {
+    if (remove(k + done * desc.key_size))
+      deleted++;
+    else if (errno != ENOENT)
+      return StatusTuple(-1, "Error removing value: %s", std::strerror(errno));
+  }
+  return StatusTuple::OK();
+}
+
+/*php add*/
+StatusTuple BPFTable::drain_table_non_atomic(TableDump &dump) {
+  TableDump keys;
+  StatusTuple r = get_table_offline_raw(keys);
+  if (!r.ok())
+    return r;
+
+  dump_reset(dump);
+  dump_reserve(dump, keys.count);
+  for (size_t i = 0; i < keys.count; i++) {
+    // Only entries that are still present once removed are reported, with
+    // the value read right before the delete
+    if (!this->lookup(keys.key(i), dump.value(dump.count)))
+      continue;
+    if (!this->remove(keys.key(i))) {
+      if (errno == ENOENT)
+        continue;
+      dump_shrink(dump);
+      return StatusTuple(-1, "Error removing value: %s", std::strerror(errno));
+    }
+    std::memcpy(dump.key(dump.count), keys.key(i), dump.key_size);
+    dump.count++;
+  }
+
+  dump_shrink(dump);
+  return StatusTuple::OK();
+}
+
+/*php add*/
+StatusTuple BPFTable::batch_dump(TableDump &dump, size_t batch_size, bool and_delete) {
+  if (batch_size == 0)
+    batch_size = DEFAULT_BATCH_SIZE;
+  if (desc.max_entries > 0 && batch_size > desc.max_entries)
+    batch_size = desc.max_entries;
+
+  // Hash maps use a 32-bit bucket cursor, arrays a key-sized one
+  size_t token_size = std::max(desc.key_size, sizeof(uint32_t));
+  std::vector<char> in_batch(token_size), out_batch(token_size);
+  bool first = true;
+
+  dump_reset(dump);
+  while (true) {
+    // The kernel writes each chunk straight behind the previous one
+    dump_reserve(dump, batch_size);
+    uint32_t count = batch_size;
+    uint32_t *in = first ? nullptr : reinterpret_cast<uint32_t*>(in_batch.data());
+    uint32_t *out = reinterpret_cast<uint32_t*>(out_batch.data());
+    int err = and_delete
+        ? bpf_lookup_and_delete_batch(desc.fd, in, out, dump.key(dump.count),
+                                      dump.value(dump.count), &count)
+        : bpf_lookup_batch(desc.fd, in, out, dump.key(dump.count),
+                           dump.value(dump.count), &count);
+    int saved_errno = errno;
+    if (err < 0 && saved_errno == ENOSPC && count == 0) {
+      // A single hash bucket holds more entries than fit in one chunk
+      batch_size *= 2;
+      continue;
+    }
+    if (err < 0 && saved_errno != ENOENT) {
+      if (first && (saved_errno == EINVAL || saved_errno == ENOTSUP ||
+                    saved_errno == ENOTSUPP))
+        return and_delete ? drain_table_non_atomic(dump) : get_table_offline_raw(dump);
+      dump_shrink(dump);
+      return StatusTuple(-1, "Error looking up batch: %s", std::strerror(saved_errno));
+    }
+
+    dump.count += count;
+    // ENOENT marks the end of the map, the last entries came with it
+    if (err < 0)
+      break;
+    in_batch.swap(out_batch);
+    first = false;
+  }
+
+  dump_shrink(dump);
+  return StatusTuple::OK();
+}
+
 size_t BPFTable::get_possible_cpu_count() { return get_possible_cpus().size(); }
 
 BPFStackTable::BPFStackTable(const TableDesc& desc, bool use_debug_file,
@@ -481,8 +744,18 @@ StatusTuple BPFPerfBuffer::open_on_cpu(perf_reader_raw_cb cb, perf_reader_lost_c
   if (cpu_readers_.find(opts.cpu) != cpu_readers_.end())
     return StatusTuple(-1, "Perf buffer already open on CPU %d", opts.cpu);
 
+  // Every CPU reader gets its own context so samples and losses can be
+  // accounted per CPU before reaching the caller's callbacks
+  raw_cb_ = cb;
+  lost_cb_ = lost_cb;
+  cb_cookie_ = cb_cookie;
+  auto& ctx = cpu_ctx_[opts.cpu];
+  ctx.reset(new cpu_ctx{this, opts.cpu, {0, 0}});
+
   auto reader = static_cast<perf_reader*>(
-      bpf_open_perf_buffer_opts(cb, lost_cb, cb_cookie, page_cnt, &opts));
+      bpf_open_perf_buffer_opts(&BPFPerfBuffer::raw_cb_trampoline,
+                                &BPFPerfBuffer::lost_cb_trampoline,
+                                ctx.get(), page_cnt, &opts));
   if (reader == nullptr)
     return StatusTuple(-1, "Unable to construct perf reader");
 
@@ -576,11 +849,42 @@ StatusTuple BPFPerfBuffer::close_all_cpu() {
     }
   }
 
+  cpu_ctx_.clear();
+
   if (has_error)
     return StatusTuple(-1, errors);
   return StatusTuple::OK();
 }
 
+void BPFPerfBuffer::raw_cb_trampoline(void* cookie, void* raw, int raw_size) {
+  auto ctx = static_cast<cpu_ctx*>(cookie);
+  BPFPerfBuffer* buffer = ctx->buffer;
+  ctx->stats.received++;
+  buffer->current_cpu_ = ctx->cpu;
+  if (buffer->raw_cb_)
+    buffer->raw_cb_(buffer->cb_cookie_, raw, raw_size);
+  buffer->current_cpu_ = -1;
+}
+
+void BPFPerfBuffer::lost_cb_trampoline(void* cookie, uint64_t lost) {
+  auto ctx = static_cast<cpu_ctx*>(cookie);
+  BPFPerfBuffer* buffer = ctx->buffer;
+  ctx->stats.lost += lost;
+  buffer->current_cpu_ = ctx->cpu;
+  if (buffer->lost_cb_)
+    buffer->lost_cb_(buffer->cb_cookie_, lost);
+  else
+    fprintf(stderr, "Possibly lost %" PRIu64 " samples\n", lost);
+  buffer->current_cpu_ = -1;
+}
+
+std::map<int, BPFPerfBuffer::cpu_stats> BPFPerfBuffer::get_cpu_stats() const {
+  std::map<int, cpu_stats> res;
+  for (auto& it : cpu_ctx_)
+    res[it.first] = it.second->stats;
+  return res;
+}
+
 int BPFPerfBuffer::poll(int timeout_ms) {
   if (epfd_ < 0)
     return -1;
@@ -131,6 +131,35 @@ class BPFTableBase {
   const TableDesc& desc;
 };
 
+/*php add*/
+// Raw contents of a map: count keys and count values, each packed back to
+// back in one buffer, so entries can be read without per-entry allocations
+struct TableDump {
+  size_t key_size = 0;
+  size_t value_size = 0;
+  size_t count = 0;
+  std::vector<char> keys;
+  std::vector<char> values;
+
+  char* key(size_t i) { return keys.data() + i * key_size; }
+  const char* key(size_t i) const { return keys.data() + i * key_size; }
+  char* value(size_t i) { return values.data() + i * value_size; }
+  const char* value(size_t i) const { return values.data() + i * value_size; }
+};
+
+/*php add*/
+// Position of a chunked read between get_table_chunk() calls
+struct TableCursor {
+  bool started = false;
+  bool done = false;
+  // Cleared once the kernel turned out not to support batch lookups
+  bool batched = true;
+  // Batch cursor, or the last key returned by the per-key walk
+  std::vector<char> token;
+  // Next index of the per-key walk over array maps
+  uint32_t index = 0;
+};
+
 class BPFTable : public BPFTableBase<void, void> {
  public:
   BPFTable(const TableDesc& desc);
@@ -150,7 +179,51 @@ class BPFTable : public BPFTableBase<void, void> {
   StatusTuple get_table_offline(std::vector<std::pair<std::string, std::string>> &res);
   StatusTuple get_table_offline_ptr(std::vector<std::pair<std::vector<char>, std::vector<char>>> &res);
 
+  /*php add*/
+  // Entries fetched per BPF_MAP_LOOKUP_BATCH call when no size is given
+  static const size_t DEFAULT_BATCH_SIZE = 4096;
+  // Bytes one lookup writes per value: leaf_size, or one 8-byte aligned slot
+  // per possible CPU for per-cpu maps
+  size_t get_value_size();
+  // Raw entries read one key at a time, without any string conversion
+  StatusTuple get_table_offline_raw(TableDump &dump);
+  // Same as get_table_offline_raw, but fetches batch_size entries per syscall
+  // with BPF_MAP_LOOKUP_BATCH. Falls back to the per-key walk when the kernel
+  // or the map type does not support batch operations.
+  StatusTuple get_table_offline_batch(TableDump &dump, size_t batch_size = 0);
+  // Reads and removes all entries with BPF_MAP_LOOKUP_AND_DELETE_BATCH, so an
+  // entry is either returned or left in the map for the next call. Without
+  // batch support each key is looked up and deleted one at a time. On error,
+  // dump still holds the entries removed before it.
+  StatusTuple drain_table_batch(TableDump &dump, size_t batch_size = 0);
+  // Replaces the contents of dump with the next chunk of at most batch_size
+  // entries, so the whole map can be read with constant memory. Sets
+  // cursor.done once the map is exhausted.
+  StatusTuple get_table_chunk(TableCursor &cursor, TableDump &dump, size_t batch_size = 0);
+  bool is_percpu();
+  // Single-key access on raw key and value buffers; false with errno set
+  bool lookup_raw(void* key, void* value) { return lookup(key, value); }
+  bool update_raw(void* key, void* value, unsigned long long flags) {
+    return bpf_update_elem(desc.fd, key, value, flags) >= 0;
+  }
+  bool remove_raw(void* key) { return remove(key); }
+  // Updates count entries packed back to back with BPF_MAP_UPDATE_BATCH,
+  // falling back to one update per key
+  StatusTuple update_batch(void* keys, void* values, size_t count);
+  // Deletes count keys packed back to back with BPF_MAP_DELETE_BATCH. Keys
+  // that are not present are skipped; deleted receives how many were removed.
+  StatusTuple delete_batch(void* keys, size_t count, size_t& deleted);
+
   static size_t get_possible_cpu_count();
+
+ private:
+  /*php add*/
+  bool is_array();
+  void dump_reset(TableDump &dump);
+  void dump_reserve(TableDump &dump, size_t n);
+  void dump_shrink(TableDump &dump);
+  StatusTuple batch_dump(TableDump &dump, size_t batch_size, bool and_delete);
+  StatusTuple drain_table_non_atomic(TableDump &dump);
 };
 
 template <class ValueType>
@@ -422,12 +495,39 @@ class BPFPerfBuffer : public BPFTableBase<int, int> {
   int poll(int timeout_ms);
   int consume();
 
+  /*php add*/
+  const std::map<int, perf_reader*>& cpu_readers() const { return cpu_readers_; }
+
+  /*php add*/
+  struct cpu_stats {
+    uint64_t received;
+    uint64_t lost;
+  };
+  // Samples received and reported lost per CPU since the buffer was opened
+  std::map<int, cpu_stats> get_cpu_stats() const;
+  // CPU of the sample or lost record currently being dispatched, -1 outside callbacks
+  int current_cpu() const { return current_cpu_; }
+
  private:
   StatusTuple open_on_cpu(perf_reader_raw_cb cb, perf_reader_lost_cb lost_cb,
                           void* cb_cookie, int page_cnt, struct bcc_perf_buffer_opts& opts);
   StatusTuple close_on_cpu(int cpu);
 
+  /*php add*/
+  struct cpu_ctx {
+    BPFPerfBuffer* buffer;
+    int cpu;
+    cpu_stats stats;
+  };
+  static void raw_cb_trampoline(void* cookie, void* raw, int raw_size);
+  static void lost_cb_trampoline(void* cookie, uint64_t lost);
+
   std::map<int, perf_reader*> cpu_readers_;
+  std::map<int, std::unique_ptr<cpu_ctx>> cpu_ctx_;
+  perf_reader_raw_cb raw_cb_ = nullptr;
+  perf_reader_lost_cb lost_cb_ = nullptr;
+  void* cb_cookie_ = nullptr;
+  int current_cpu_ = -1;
 
   int epfd_;
   std::unique_ptr<epoll_event[]> ep_events_;
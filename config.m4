@@ -103,6 +103,9 @@ if test "$PHP_EBPF" != "no"; then
 
 
   source_file="ebpf.cpp \
+        ebpf_schema.cpp \
+        ebpf_hist.cpp \
+        ebpf_profile.cpp \
         $API_SOURCE/BPF.cc \
         $API_SOURCE/BPFTable.cc"
 
@@ -27,21 +27,39 @@ extern "C" {
 #include "php.h"
 #include "wrapper.h"
 #include "php_ini.h"
+#include "zend_interfaces.h"
 #include "ext/standard/info.h"
 }
 
 #include "BPF.h"
 #include "php_ebpf.h"
+#include "ebpf_schema.h"
+#include "ebpf_hist.h"
+#include "ebpf_profile.h"
 #include "bcc_common.h"
+#include "common.h"
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <regex>
-#include <iomanip>
+#include <new>
+#include <algorithm>
+#include <unordered_map>
+#include <ctime>
+#include <cstdio>
+#include <linux/elf.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <unistd.h>
 
 /* Handlers */
 zend_object_handlers bpf_object_handlers;
 zend_object_handlers table_object_handlers;
+zend_object_handlers histogram_object_handlers;
+zend_object_handlers profile_object_handlers;
 
 /* Class entries */
 zend_class_entry *bpf_ce;
@@ -64,6 +82,8 @@ zend_class_entry *map_in_map_hash_table_ce;
 zend_class_entry *queue_stack_table_ce;
 zend_class_entry *ring_buf_table_ce;
 zend_class_entry *bpf_prog_func_ce;
+zend_class_entry *histogram_ce;
+zend_class_entry *profile_ce;
 
 /* Objects */
 typedef struct _bpf_object {
@@ -71,33 +91,315 @@ typedef struct _bpf_object {
 	zend_object std;
 } bpf_object;
 
+/* Counters returned by the previous deltas() call, keyed by raw key bytes */
+struct table_snapshot {
+	std::unordered_map<std::string, zend_long> values;
+	struct timespec taken;
+};
+
 typedef struct _sub_object {
 	ebpf::BPF *bpf;
+	perf_buffer_batch *batch;
+	TableSchema *key_schema;
+	TableSchema *leaf_schema;
+	zend_fcall_info fci;
+	zend_fcall_info_cache fcc;
+	zend_fcall_info lost_fci;
+	zend_fcall_info_cache lost_fcc;
+	ebpf::BPFPerfBuffer *perf_buffer;
+	zend_ulong received;
+	table_snapshot *snapshot;
+	EbpfExtension *ext;
+	/* Resolved once when the wrapper is created; table storage entries
+	   live as long as the module */
+	const ebpf::TableDesc *desc;
+	/* Bpf object the table was handed out by. The Bpf keeps the wrapper in
+	   its table cache, the wrapper only takes a reference on the Bpf when
+	   it is still in use as the Bpf is destroyed (owns_parent) */
+	zend_object *parent;
+	bool owns_parent;
+	/* Scratch list for get_gc: parent and callbacks */
+	zval gc_refs[3];
 	zend_object std;
 } sub_object;
 
-std::string cb_fn;
+typedef struct _histogram_object {
+	Histogram *hist;
+	zend_object std;
+} histogram_object;
 
-void callbackfn(void *cookie, void *data, int data_size) {
-	zval params[3];
+typedef struct _profile_object {
+	ProfileBuilder *profile;
+	zend_object std;
+} profile_object;
+
+/* Callables are resolved once by zend_parse_parameters("f") or
+   zend_fcall_info_init() and kept on the table, whose native state is
+   the cookie of the opened buffer */
+static void fcall_release(zend_fcall_info *fci) {
+	if (ZEND_FCI_INITIALIZED(*fci)) {
+		zval_ptr_dtor(&fci->function_name);
+		fci->size = 0;
+	}
+}
+
+static void fcall_store(zend_fcall_info *dst, zend_fcall_info_cache *dst_cache,
+                        zend_fcall_info *fci, zend_fcall_info_cache *fcc) {
+	fcall_release(dst);
+	*dst = *fci;
+	*dst_cache = *fcc;
+	Z_TRY_ADDREF(dst->function_name);
+}
+
+static void fcall_call(zend_fcall_info *fci, zend_fcall_info_cache *fcc, uint32_t param_count, zval *params) {
 	zval retval;
 
-	ZVAL_LONG(&params[0], 0);
-	ZVAL_STRINGL(&params[1], (const char *) data, data_size);
-	ZVAL_LONG(&params[2], data_size);
-	zval function_name;
-	ZVAL_STRING(&function_name, cb_fn.c_str());
-	if (call_user_function(EG(function_table), nullptr, &function_name, &retval, 3, params) == SUCCESS) {
+	fci->retval = &retval;
+	fci->params = params;
+	fci->param_count = param_count;
+	if (zend_call_function(fci, fcc) == SUCCESS) {
 		zval_ptr_dtor(&retval);
+	} else if (!EG(exception)) {
+		php_error_docref(NULL, E_WARNING, "Failed to call buffer callback");
+	}
+	fci->params = NULL;
+	fci->param_count = 0;
+}
+
+static inline void table_call(sub_object *table, uint32_t param_count, zval *params) {
+	fcall_call(&table->fci, &table->fcc, param_count, params);
+}
+
+static perf_buffer_batch *perf_batch_new(zend_long max_size) {
+	perf_buffer_batch *batch = (perf_buffer_batch *) emalloc(sizeof(perf_buffer_batch));
+	batch->max_size = max_size;
+	array_init_size(&batch->events, (uint32_t) std::min<zend_long>(max_size, PERF_BUFFER_BATCH_INIT_SIZE));
+	return batch;
+}
+
+static void perf_batch_free(perf_buffer_batch *batch) {
+	if (!batch) {
+		return;
+	}
+	zval_ptr_dtor(&batch->events);
+	efree(batch);
+}
+
+static void perf_batch_flush(sub_object *table) {
+	perf_buffer_batch *batch = table->batch;
+	if (!batch || zend_hash_num_elements(Z_ARRVAL(batch->events)) == 0) {
+		return;
+	}
+
+	table_call(table, 1, &batch->events);
+
+	// Reuse the bucket storage unless the callback kept a reference to the batch
+	if (Z_REFCOUNT(batch->events) == 1) {
+		zend_hash_clean(Z_ARRVAL(batch->events));
+	} else {
+		zval_ptr_dtor(&batch->events);
+		array_init_size(&batch->events, (uint32_t) std::min<zend_long>(batch->max_size, PERF_BUFFER_BATCH_INIT_SIZE));
+	}
+}
+
+static void table_decode(const TableSchema *schema, const void *data, size_t size, zval *out) {
+	if (schema) {
+		schema->decode((const char *) data, size, out);
 	} else {
-		php_error_docref(NULL, E_WARNING, "Failed to call callback function '%s'", cb_fn.c_str());
+		ZVAL_STRINGL(out, (const char *) data, size);
+	}
+}
+
+/* Decode a value as read from the map. Per-cpu maps return one 8-byte
+   aligned slot per possible CPU, decoded into a list indexed by CPU */
+static void table_decode_value(const TableSchema *schema, size_t leaf_size, bool percpu,
+                               const char *data, size_t size, zval *out) {
+	if (!percpu) {
+		table_decode(schema, data, size, out);
+		return;
+	}
+
+	size_t slot = (leaf_size + 7) & ~(size_t) 7;
+	array_init_size(out, (uint32_t) (size / slot));
+	for (size_t off = 0; off + slot <= size; off += slot) {
+		zval value;
+		table_decode(schema, data + off, leaf_size, &value);
+		add_next_index_zval(out, &value);
+	}
+}
+
+/* Encode a key or a single value: through the schema when set_schema() gave
+   one, otherwise from a raw string of exactly size bytes or an integer */
+static bool table_encode(const TableSchema *schema, zval *in, char *out, size_t size, std::string &err) {
+	memset(out, 0, size);
+	if (schema) {
+		return schema->encode(in, out, size, err);
+	}
+	if (Z_TYPE_P(in) == IS_STRING && Z_STRLEN_P(in) == size) {
+		memcpy(out, Z_STRVAL_P(in), size);
+		return true;
+	}
+	if (Z_TYPE_P(in) == IS_LONG && size <= sizeof(zend_long)) {
+		zend_long v = Z_LVAL_P(in);
+		memcpy(out, &v, size);
+		return true;
+	}
+	err = "expected a " + std::to_string(size) + " byte string" + (size <= sizeof(zend_long) ? " or an integer" : "");
+	return false;
+}
+
+/* Inverse of table_decode_value(): per-cpu maps take a list indexed by CPU,
+   CPUs missing from it are written as zero */
+static bool table_encode_value(const TableSchema *schema, size_t leaf_size, bool percpu,
+                               zval *in, char *out, size_t size, std::string &err) {
+	if (!percpu) {
+		return table_encode(schema, in, out, size, err);
+	}
+	if (Z_TYPE_P(in) != IS_ARRAY) {
+		err = "per-cpu values must be an array indexed by CPU";
+		return false;
+	}
+
+	size_t slot = (leaf_size + 7) & ~(size_t) 7;
+	memset(out, 0, size);
+	for (size_t cpu = 0; (cpu + 1) * slot <= size; cpu++) {
+		zval *value = zend_hash_index_find(Z_ARRVAL_P(in), cpu);
+		if (value && !table_encode(schema, value, out + cpu * slot, leaf_size, err)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Build the [["key" => ..., "value" => ...], ...] list returned by values() and drain() */
+static void table_dump_entries(sub_object *table, const ebpf::TableDesc *desc, bool percpu,
+                               const ebpf::TableDump &dump, zval *out) {
+	array_init_size(out, (uint32_t) dump.count);
+
+	for (size_t i = 0; i < dump.count; i++) {
+		zval entry, key, value;
+		array_init_size(&entry, 2);
+		table_decode(table->key_schema, dump.key(i), dump.key_size, &key);
+		table_decode_value(table->leaf_schema, desc->leaf_size, percpu, dump.value(i), dump.value_size, &value);
+		add_assoc_zval(&entry, "key", &key);
+		add_assoc_zval(&entry, "value", &value);
+		add_next_index_zval(out, &entry);
+	}
+}
+
+/* Read the "chunk_size" dump option: entries fetched per batch syscall, 0 for the default */
+static bool table_dump_options(zval *options, size_t *chunk_size) {
+	*chunk_size = 0;
+	if (!options || Z_TYPE_P(options) != IS_ARRAY) {
+		return true;
+	}
+
+	zval *tmp;
+	if ((tmp = zend_hash_str_find(Z_ARRVAL_P(options), "chunk_size", strlen("chunk_size"))) != NULL) {
+		zend_long value = zval_get_long(tmp);
+		if (value < 0) {
+			zend_throw_error(NULL, "chunk_size must not be negative");
+			return false;
+		}
+		*chunk_size = (size_t) value;
+	}
+	return true;
+}
+
+/* Resolve the schema requested by set_schema(): true derives it from the
+   table, false/null keeps raw strings, anything else is an explicit layout */
+static bool table_build_schema(sub_object *table, const char *name, zval *spec, bool is_key,
+                               TableSchema **out, std::string &err) {
+	*out = nullptr;
+	if (spec && (Z_TYPE_P(spec) == IS_FALSE || Z_TYPE_P(spec) == IS_NULL)) {
+		return true;
+	}
+
+	const ebpf::TableDesc *desc = table->bpf->get_table_desc(name);
+	if (!desc) {
+		err = std::string("table ") + name + " not found";
+		return false;
+	}
+
+	bool is_perf = desc->type == BPF_MAP_TYPE_PERF_EVENT_ARRAY || desc->type == BPF_MAP_TYPE_RINGBUF;
+	if (!spec || Z_TYPE_P(spec) == IS_TRUE) {
+		if (is_perf) {
+			// Output records carry no key; the value layout is the struct given to perf_submit()/ringbuf_output()
+			*out = is_key ? nullptr : TableSchema::from_perf_fields(table->bpf->get_perf_event_fields(name), err);
+			return is_key || *out;
+		}
+		*out = TableSchema::from_desc(is_key ? desc->key_desc : desc->leaf_desc, err);
+		return *out != nullptr;
+	}
+
+	*out = TableSchema::from_zval(spec, err);
+	if (!*out) {
+		return false;
+	}
+
+	size_t expected = is_key ? desc->key_size : desc->leaf_size;
+	if (!is_perf && (*out)->size() > expected) {
+		err = std::string(is_key ? "key" : "value") + " schema is " + std::to_string((*out)->size()) +
+		      " bytes but the table stores " + std::to_string(expected);
+		delete *out;
+		*out = nullptr;
+		return false;
+	}
+	return true;
+}
+
+void callbackfn(void *cookie, void *data, int data_size) {
+	sub_object *table = static_cast<sub_object *>(cookie);
+	perf_buffer_batch *batch = table->batch;
+	table->received++;
+	if (batch) {
+		zval event;
+		table_decode(table->leaf_schema, data, data_size, &event);
+		add_next_index_zval(&batch->events, &event);
+		if (zend_hash_num_elements(Z_ARRVAL(batch->events)) >= (uint32_t) batch->max_size) {
+			perf_batch_flush(table);
+		}
+		return;
 	}
 
+	zval params[3];
+
+	ZVAL_LONG(&params[0], table->perf_buffer ? table->perf_buffer->current_cpu() : 0);
+	table_decode(table->leaf_schema, data, data_size, &params[1]);
+	ZVAL_LONG(&params[2], data_size);
+	table_call(table, 3, params);
 
 	zval_ptr_dtor(&params[0]);
 	zval_ptr_dtor(&params[1]);
 	zval_ptr_dtor(&params[2]);
-	zval_ptr_dtor(&function_name);
+}
+
+void lostcbfn(void *cookie, uint64_t lost) {
+	sub_object *table = static_cast<sub_object *>(cookie);
+	if (!ZEND_FCI_INITIALIZED(table->lost_fci)) {
+		return;
+	}
+
+	zval params[2];
+
+	ZVAL_LONG(&params[0], (zend_long) lost);
+	ZVAL_LONG(&params[1], table->perf_buffer ? table->perf_buffer->current_cpu() : -1);
+	fcall_call(&table->lost_fci, &table->lost_fcc, 2, params);
+}
+
+int ringbuf_callbackfn(void *cookie, void *data, size_t data_size) {
+	sub_object *table = static_cast<sub_object *>(cookie);
+	zval params[3];
+
+	table->received++;
+	ZVAL_NULL(&params[0]);
+	table_decode(table->leaf_schema, data, data_size, &params[1]);
+	ZVAL_LONG(&params[2], (zend_long) data_size);
+	table_call(table, 3, params);
+	zval_ptr_dtor(&params[1]);
+
+	// A non-zero return stops libbpf from consuming further records
+	return EG(exception) ? -1 : 0;
 }
 
 static inline bpf_object *bpf_fetch_object(zend_object *obj) {
@@ -108,11 +410,258 @@ static inline sub_object *table_fetch_object(zend_object *obj) {
 	return (sub_object *) ((char *) (obj) - XtOffsetOf(sub_object, std));
 }
 
+static inline histogram_object *histogram_fetch_object(zend_object *obj) {
+	return (histogram_object *) ((char *) (obj) - XtOffsetOf(histogram_object, std));
+}
+
+static inline profile_object *profile_fetch_object(zend_object *obj) {
+	return (profile_object *) ((char *) (obj) - XtOffsetOf(profile_object, std));
+}
+
+/* Resolve the map behind a table object, throwing when it cannot be used.
+   The desc was looked up once, when the Bpf object created the wrapper */
+static sub_object *table_this(zval *self, const char **name, const ebpf::TableDesc **desc) {
+	sub_object *obj = table_fetch_object(Z_OBJ_P(self));
+	if (!obj || !obj->bpf || !obj->desc) {
+		zend_throw_error(NULL, "Invalid object state");
+		return nullptr;
+	}
+
+	*desc = obj->desc;
+	*name = obj->desc->name.c_str();
+	return obj;
+}
+
+/* Opened buffers are polled through EbpfExtension::_buffers */
+static void table_register_buffer(sub_object *table) {
+	auto &buffers = table->ext->_buffers;
+	if (std::find(buffers.begin(), buffers.end(), table) == buffers.end()) {
+		buffers.push_back(table);
+	}
+}
+
+static void table_unregister(sub_object *table) {
+	if (!table->ext) {
+		return;
+	}
+	auto &buffers = table->ext->_buffers;
+	buffers.erase(std::remove(buffers.begin(), buffers.end(), table), buffers.end());
+	auto &wrappers = table->ext->_wrappers;
+	wrappers.erase(std::remove(wrappers.begin(), wrappers.end(), table), wrappers.end());
+}
+
+/* {{{ compiled program cache */
+static const uint64_t PROGRAM_CACHE_FNV_OFFSET = 14695981039346656037ULL;
+static const uint64_t PROGRAM_CACHE_FNV_PRIME = 1099511628211ULL;
+
+/* mtime and size of the files that change with the kernel headers bcc compiles against */
+static std::string program_cache_headers_stamp(const std::string &release) {
+	const std::string paths[] = {
+			"/lib/modules/" + release + "/build/include/generated/autoconf.h",
+			"/lib/modules/" + release + "/build/include/generated/uapi/linux/version.h",
+			"/lib/modules/" + release + "/source/Makefile",
+			"/sys/kernel/kheaders.tar.xz"
+	};
+	std::string stamp;
+	for (const auto &path: paths) {
+		struct stat st;
+		if (stat(path.c_str(), &st) == 0) {
+			stamp += std::to_string((long long) st.st_mtime) + ":" + std::to_string((long long) st.st_size);
+		}
+		stamp += ";";
+	}
+	return stamp;
+}
+
+/* Everything a compiled image depends on. Stored in the cache file and compared
+   in full on lookup, the file name hash only spreads the entries. */
+static std::string program_cache_key(const std::string &source, const std::vector<std::string> &cflags) {
+	std::string key = source;
+	key += '\0';
+	for (const auto &flag: cflags) {
+		key += flag;
+		key += '\0';
+	}
+	struct utsname uts;
+	if (uname(&uts) == 0) {
+		key += uts.release;
+		key += '\0';
+		key += uts.version;
+		key += '\0';
+		key += uts.machine;
+		key += '\0';
+		key += program_cache_headers_stamp(uts.release);
+	}
+	key += '\0';
+	// Perf event arrays are sized by the number of possible CPUs at compile time
+	key += std::to_string(ebpf::get_possible_cpus().size());
+	return key;
+}
+
+static std::string program_cache_path(const std::string &dir, const std::string &key) {
+	uint64_t hash = PROGRAM_CACHE_FNV_OFFSET;
+	for (unsigned char c: key) {
+		hash = (hash ^ c) * PROGRAM_CACHE_FNV_PRIME;
+	}
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bpfimg", (unsigned long long) hash);
+	return dir + "/" + name;
+}
+
+/* Entries are loaded as BPF bytecode, so the directory and every entry
+   must belong to this user and be writable by nobody else */
+static bool program_cache_trusted(const struct stat &st) {
+	return st.st_uid == geteuid() && !(st.st_mode & (S_IWGRP | S_IWOTH));
+}
+
+static bool program_cache_dir_check(const std::string &dir, std::string &err) {
+	if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+		err = "cannot create cache_dir " + dir + ": " + strerror(errno);
+		return false;
+	}
+	struct stat st;
+	if (lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+		err = "cache_dir " + dir + " is not a directory";
+		return false;
+	}
+	if (!program_cache_trusted(st)) {
+		err = "cache_dir " + dir + " must be owned by the current user and not writable by group or others";
+		return false;
+	}
+	return true;
+}
+
+static bool program_cache_load(const std::string &path, const std::string &key, std::string &image) {
+	int fd = open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || !program_cache_trusted(st)) {
+		close(fd);
+		return false;
+	}
+	std::string data;
+	char buf[65536];
+	ssize_t n;
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		data.append(buf, (size_t) n);
+	}
+	close(fd);
+	if (n < 0) {
+		return false;
+	}
+
+	uint64_t key_len;
+	if (data.size() < sizeof(key_len)) {
+		return false;
+	}
+	memcpy(&key_len, data.data(), sizeof(key_len));
+	if (data.size() - sizeof(key_len) < key_len || data.compare(sizeof(key_len), key_len, key) != 0) {
+		return false;
+	}
+	image = data.substr(sizeof(key_len) + key_len);
+	return true;
+}
+
+static bool program_cache_write(int fd, const char *data, size_t len) {
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		data += n;
+		len -= (size_t) n;
+	}
+	return true;
+}
+
+/* Written to a fresh temporary file and renamed, so concurrent starts never
+   read half an entry and nothing already in the directory is written to */
+static void program_cache_store(const std::string &path, const std::string &key, const std::string &image) {
+	std::string tmp = path + ".tmpXXXXXX";
+	int fd = mkstemp(&tmp[0]);
+	if (fd < 0) {
+		return;
+	}
+	uint64_t key_len = key.size();
+	bool ok = program_cache_write(fd, reinterpret_cast<const char *>(&key_len), sizeof(key_len)) &&
+	          program_cache_write(fd, key.data(), key.size()) &&
+	          program_cache_write(fd, image.data(), image.size());
+	if (close(fd) != 0 || !ok || rename(tmp.c_str(), path.c_str()) != 0) {
+		unlink(tmp.c_str());
+	}
+}
+/* }}} */
+
+ebpf::StatusTuple EbpfExtension::init(const std::string &bpf_program, const std::vector<std::string> &cflags,
+                                      const std::string &cache_dir) {
+	_from_cache = false;
+	if (cache_dir.empty()) {
+		return bpf.init(bpf_program, cflags);
+	}
+
+	std::string err;
+	if (!program_cache_dir_check(cache_dir, err)) {
+		return ebpf::StatusTuple(-1, "%s", err.c_str());
+	}
+
+	std::string key = program_cache_key(bpf_program, cflags);
+	std::string path = program_cache_path(cache_dir, key);
+	std::string image;
+	// A stale or unusable entry falls through to a normal compile, which replaces it
+	if (program_cache_load(path, key, image) && bpf.init_image(image).code() == 0) {
+		_from_cache = true;
+		return ebpf::StatusTuple::OK();
+	}
+
+	auto res = bpf.init(bpf_program, cflags);
+	if (res.code() == 0 && bpf.save_image(image).code() == 0) {
+		program_cache_store(path, key, image);
+	}
+	return res;
+}
+
+/* Resident set size of this process, from /proc/self/statm */
+static size_t process_rss() {
+	std::ifstream statm("/proc/self/statm");
+	size_t size = 0, resident = 0;
+	if (!(statm >> size >> resident)) {
+		return 0;
+	}
+	return resident * (size_t) sysconf(_SC_PAGESIZE);
+}
+
+ebpf::StatusTuple EbpfExtension::free_bcc_memory(size_t &reclaimed) {
+	size_t before = process_rss();
+	int res = bpf.free_bcc_memory();
+	if (res != 0) {
+		reclaimed = 0;
+		return ebpf::StatusTuple(-1, "bcc_free_memory failed: %d", res);
+	}
+#ifdef __GLIBC__
+	// Hand the pages freed by the compiler back to the kernel, glibc keeps them otherwise
+	malloc_trim(0);
+#endif
+	size_t after = process_rss();
+	reclaimed = before > after ? before - after : 0;
+	_bcc_memory_reclaimed += reclaimed;
+	return ebpf::StatusTuple::OK();
+}
+
 void EbpfExtension::_trace_autoload() {
-	size_t num_funcs = bpf_num_functions(mod);
+	size_t num_funcs = bpf.get_num_functions();
 	for (size_t i = 0; i < num_funcs; i++) {
-		const char *func_name = bpf_function_name(mod, i);
+		const char *func_name = bpf.get_function_name(i);
 		std::string fn_name(func_name);
+		const char *section = bpf.get_function_section(i);
+		if (section) {
+			_section_autoload(fn_name, section);
+			continue;
+		}
 		if (fn_name.rfind("kprobe__", 0) == 0) {
 			std::string kernel_func = fix_syscall_fnname(fn_name.substr(8));
 			bpf.attach_kprobe(kernel_func, fn_name);
@@ -142,6 +691,34 @@ void EbpfExtension::_trace_autoload() {
 	}
 }
 
+void EbpfExtension::_section_autoload(const std::string &fn_name, const std::string &section) {
+	size_t slash = section.find('/');
+	if (slash == std::string::npos || slash + 1 == section.size()) {
+		return;
+	}
+	std::string kind = section.substr(0, slash);
+	std::string target = section.substr(slash + 1);
+
+	if (kind == "kprobe") {
+		bpf.attach_kprobe(fix_syscall_fnname(target), fn_name);
+	} else if (kind == "kretprobe") {
+		bpf.attach_kprobe(fix_syscall_fnname(target), fn_name, 0, BPF_PROBE_RETURN);
+	} else if (kind == "tracepoint" || kind == "tp") {
+		size_t sep = target.find('/');
+		if (sep != std::string::npos) {
+			target.replace(sep, 1, ":");
+		}
+		bpf.attach_tracepoint(target, fn_name);
+	} else if (kind == "raw_tracepoint" || kind == "raw_tp") {
+		bpf.attach_raw_tracepoint(target, fn_name);
+	} else if (kind == "fentry" || kind == "fexit") {
+		// libbpf resolved the target BTF id at load time, the program fd is all that is needed
+		attach_kfunc(fn_name);
+	} else if (kind == "lsm") {
+		attach_lsm(fn_name);
+	}
+}
+
 std::string EbpfExtension::add_prefix(const std::string &prefix, const std::string &name) {
 	if (name.rfind(prefix, 0) != 0) {
 		return prefix + name;
@@ -158,237 +735,96 @@ std::string EbpfExtension::fix_syscall_fnname(const std::string &name) {
 	return name;
 }
 
-zval EbpfExtension::get_table_cls(const char *table_name, int from_attr) {
+zval EbpfExtension::get_table_cls(zend_object *parent, const char *table_name, int from_attr) {
 	zval retval;
 	ZVAL_NULL(&retval);
 
-	int ttype = bpf_table_type(this->mod, table_name);
+	zval *cached = zend_hash_str_find(Z_ARRVAL(_tables), table_name, strlen(table_name));
+	if (cached) {
+		ZVAL_COPY(&retval, cached);
+		return retval;
+	}
+
+	const ebpf::TableDesc *desc = bpf.get_table_desc(table_name);
+	int ttype = desc ? desc->type : -1;
+
+	zend_class_entry *ce;
+	const char *class_name;
 
 	switch (ttype) {
-		case BPF_MAP_TYPE_HASH: {
-			if (!hash_table_ce) {
-				zend_throw_error(NULL, "HashTable class not found");
-				return retval;
-			}
-			object_init_ex(&retval, hash_table_ce);
-			sc_zend_update_property_string(hash_table_ce, &retval, "name", sizeof("name") - 1, table_name);
-			sub_object *table_obj = table_fetch_object(Z_OBJ(retval));
-			table_obj->bpf = &this->bpf;
-			Z_ADDREF(retval);
+		case BPF_MAP_TYPE_HASH:
+			ce = hash_table_ce;
+			class_name = "HashTable";
 			break;
-		}
-		case BPF_MAP_TYPE_ARRAY: {
-			if (!array_table_ce) {
-				zend_throw_error(NULL, "ArrayTable class not found");
-				return retval;
-			}
-			object_init_ex(&retval, array_table_ce);
-			sc_zend_update_property_string(array_table_ce, &retval, "name", sizeof("name") - 1, table_name);
-			sub_object *table_obj = table_fetch_object(Z_OBJ(retval));
-			table_obj->bpf = &this->bpf;
-			Z_ADDREF(retval);
+		case BPF_MAP_TYPE_ARRAY:
+			ce = array_table_ce;
+			class_name = "ArrayTable";
 			break;
-		}
-		case BPF_MAP_TYPE_PROG_ARRAY: {
-			if (!prog_array_table_ce) {
-				zend_throw_error(NULL, "ProgArrayTable class not found");
-				return retval;
-			}
-			object_init_ex(&retval, prog_array_table_ce);
-			sc_zend_update_property_string(prog_array_table_ce, &retval, "name", sizeof("name") - 1, table_name);
-			sub_object *table_obj = table_fetch_object(Z_OBJ(retval));
-			table_obj->bpf = &this->bpf;
-			Z_ADDREF(retval);
+		case BPF_MAP_TYPE_PROG_ARRAY:
+			ce = prog_array_table_ce;
+			class_name = "ProgArrayTable";
 			break;
-		}
-		case BPF_MAP_TYPE_PERF_EVENT_ARRAY: {
-			if (Z_TYPE(_class_perf_event_obj) != IS_UNDEF) {
-				ZVAL_COPY(&retval, &_class_perf_event_obj);
-				return retval;
-			}
-			if (!perf_event_array_table_ce) {
-				zend_throw_error(NULL, "PerfEventArrayTable class not found");
-				return retval;
-			}
-			object_init_ex(&retval, perf_event_array_table_ce);
-			sc_zend_update_property_string(perf_event_array_table_ce, &retval, "name", sizeof("name") - 1, table_name);
-			sub_object *table_obj = table_fetch_object(Z_OBJ(retval));
-			table_obj->bpf = &this->bpf;
-			Z_ADDREF(retval);
-			ZVAL_COPY(&_class_perf_event_obj, &retval);
-			return retval;
-		}
-		case BPF_MAP_TYPE_PERCPU_HASH: {
-			if (!per_cpu_hash_table_ce) {
-				zend_throw_error(NULL, "PerCpuHashTable class not found");
-				return retval;
-			}
-			object_init_ex(&retval, per_cpu_hash_table_ce);
-			sc_zend_update_property_string(per_cpu_hash_table_ce, &retval, "name", sizeof("name") - 1, table_name);
-			sub_object *table_obj = table_fetch_object(Z_OBJ(retval));
-			table_obj->bpf = &this->bpf;
-			Z_ADDREF(retval);
+		case BPF_MAP_TYPE_PERF_EVENT_ARRAY:
+			ce = perf_event_array_table_ce;
+			class_name = "PerfEventArrayTable";
 			break;
-		}
-		case BPF_MAP_TYPE_PERCPU_ARRAY: {
-			if (!per_cpu_array_table_ce) {
-				zend_throw_error(NULL, "PerCpuArrayTable class not found");
-				return retval;
-			}
-			object_init_ex(&retval, per_cpu_array_table_ce);
-			sc_zend_update_property_string(per_cpu_array_table_ce, &retval, "name", sizeof("name") - 1, table_name);
-			sub_object *table_obj = table_fetch_object(Z_OBJ(retval));
-			table_obj->bpf = &this->bpf;
-			Z_ADDREF(retval);
+		case BPF_MAP_TYPE_PERCPU_HASH:
+			ce = per_cpu_hash_table_ce;
+			class_name = "PerCpuHashTable";
 			break;
-		}
-		case BPF_MAP_TYPE_LPM_TRIE: {
-			if (!lpm_trie_table_ce) {
-				zend_throw_error(NULL, "LpmTrieTable class not found");
-				return retval;
-			}
-			object_init_ex(&retval, lpm_trie_table_ce);
-			sc_zend_update_property_string(lpm_trie_table_ce, &retval, "name", sizeof("name") - 1, table_name);
-			sub_object *table_obj = table_fetch_object(Z_OBJ(retval));
-			table_obj->bpf = &this->bpf;
-			Z_ADDREF(retval);
+		case BPF_MAP_TYPE_PERCPU_ARRAY:
+			ce = per_cpu_array_table_ce;
+			class_name = "PerCpuArrayTable";
 			break;
-		}
-		case BPF_MAP_TYPE_STACK_TRACE: {
-			if (!stack_trace_table_ce) {
-				zend_throw_error(NULL, "StackTraceTable class not found");
-				return retval;
-			}
-			object_init_ex(&retval, stack_trace_table_ce);
-			sc_zend_update_property_string(stack_trace_table_ce, &retval, "name", sizeof("name") - 1, table_name);
-			sub_object *table_obj = table_fetch_object(Z_OBJ(retval));
-			table_obj->bpf = &this->bpf;
-			Z_ADDREF(retval);
+		case BPF_MAP_TYPE_LPM_TRIE:
+			ce = lpm_trie_table_ce;
+			class_name = "LpmTrieTable";
 			break;
-		}
-		case BPF_MAP_TYPE_LRU_HASH: {
-			if (!lru_hash_table_ce) {
-				zend_throw_error(NULL, "LruHashTable class not found");
-				return retval;
-			}
-			object_init_ex(&retval, lru_hash_table_ce);
-			sc_zend_update_property_string(lru_hash_table_ce, &retval, "name", sizeof("name") - 1, table_name);
-			sub_object *table_obj = table_fetch_object(Z_OBJ(retval));
-			table_obj->bpf = &this->bpf;
-			Z_ADDREF(retval);
+		case BPF_MAP_TYPE_STACK_TRACE:
+			ce = stack_trace_table_ce;
+			class_name = "StackTraceTable";
 			break;
-		}
-		case BPF_MAP_TYPE_LRU_PERCPU_HASH: {
-			if (!lru_per_cpu_hash_table_ce) {
-				zend_throw_error(NULL, "LruPerCpuHashTable class not found");
-				return retval;
-			}
-			object_init_ex(&retval, lru_per_cpu_hash_table_ce);
-			sc_zend_update_property_string(lru_per_cpu_hash_table_ce, &retval, "name", sizeof("name") - 1, table_name);
-			sub_object *table_obj = table_fetch_object(Z_OBJ(retval));
-			table_obj->bpf = &this->bpf;
-			Z_ADDREF(retval);
+		case BPF_MAP_TYPE_LRU_HASH:
+			ce = lru_hash_table_ce;
+			class_name = "LruHashTable";
 			break;
-		}
-		case BPF_MAP_TYPE_CGROUP_ARRAY: {
-			if (!cgroup_array_table_ce) {
-				zend_throw_error(NULL, "CgroupArrayTable class not found");
-				return retval;
-			}
-			object_init_ex(&retval, cgroup_array_table_ce);
-			sc_zend_update_property_string(cgroup_array_table_ce, &retval, "name", sizeof("name") - 1, table_name);
-			sub_object *table_obj = table_fetch_object(Z_OBJ(retval));
-			table_obj->bpf = &this->bpf;
-			Z_ADDREF(retval);
+		case BPF_MAP_TYPE_LRU_PERCPU_HASH:
+			ce = lru_per_cpu_hash_table_ce;
+			class_name = "LruPerCpuHashTable";
 			break;
-		}
-		case BPF_MAP_TYPE_DEVMAP: {
-			if (!dev_map_table_ce) {
-				zend_throw_error(NULL, "DevMapTable class not found");
-				return retval;
-			}
-			object_init_ex(&retval, dev_map_table_ce);
-			sc_zend_update_property_string(dev_map_table_ce, &retval, "name", sizeof("name") - 1, table_name);
-			sub_object *table_obj = table_fetch_object(Z_OBJ(retval));
-			table_obj->bpf = &this->bpf;
-			Z_ADDREF(retval);
+		case BPF_MAP_TYPE_CGROUP_ARRAY:
+			ce = cgroup_array_table_ce;
+			class_name = "CgroupArrayTable";
 			break;
-		}
-		case BPF_MAP_TYPE_CPUMAP: {
-			if (!cpu_map_table_ce) {
-				zend_throw_error(NULL, "CpuMapTable class not found");
-				return retval;
-			}
-			object_init_ex(&retval, cpu_map_table_ce);
-			sc_zend_update_property_string(cpu_map_table_ce, &retval, "name", sizeof("name") - 1, table_name);
-			sub_object *table_obj = table_fetch_object(Z_OBJ(retval));
-			table_obj->bpf = &this->bpf;
-			Z_ADDREF(retval);
+		case BPF_MAP_TYPE_DEVMAP:
+			ce = dev_map_table_ce;
+			class_name = "DevMapTable";
 			break;
-		}
-		case BPF_MAP_TYPE_XSKMAP: {
-			if (!xsk_map_table_ce) {
-				zend_throw_error(NULL, "XskMapTable class not found");
-				return retval;
-			}
-			object_init_ex(&retval, xsk_map_table_ce);
-			sc_zend_update_property_string(xsk_map_table_ce, &retval, "name", sizeof("name") - 1, table_name);
-			sub_object *table_obj = table_fetch_object(Z_OBJ(retval));
-			table_obj->bpf = &this->bpf;
-			Z_ADDREF(retval);
+		case BPF_MAP_TYPE_CPUMAP:
+			ce = cpu_map_table_ce;
+			class_name = "CpuMapTable";
 			break;
-		}
-		case BPF_MAP_TYPE_ARRAY_OF_MAPS: {
-			if (!map_in_map_array_table_ce) {
-				zend_throw_error(NULL, "MapInMapArrayTable class not found");
-				return retval;
-			}
-			object_init_ex(&retval, map_in_map_array_table_ce);
-			sc_zend_update_property_string(map_in_map_array_table_ce, &retval, "name", sizeof("name") - 1, table_name);
-			sub_object *table_obj = table_fetch_object(Z_OBJ(retval));
-			table_obj->bpf = &this->bpf;
-			Z_ADDREF(retval);
+		case BPF_MAP_TYPE_XSKMAP:
+			ce = xsk_map_table_ce;
+			class_name = "XskMapTable";
 			break;
-		}
-		case BPF_MAP_TYPE_HASH_OF_MAPS: {
-			if (!map_in_map_hash_table_ce) {
-				zend_throw_error(NULL, "MapInMapHashTable class not found");
-				return retval;
-			}
-			object_init_ex(&retval, map_in_map_hash_table_ce);
-			sc_zend_update_property_string(map_in_map_hash_table_ce, &retval, "name", sizeof("name") - 1, table_name);
-			sub_object *table_obj = table_fetch_object(Z_OBJ(retval));
-			table_obj->bpf = &this->bpf;
-			Z_ADDREF(retval);
+		case BPF_MAP_TYPE_ARRAY_OF_MAPS:
+			ce = map_in_map_array_table_ce;
+			class_name = "MapInMapArrayTable";
+			break;
+		case BPF_MAP_TYPE_HASH_OF_MAPS:
+			ce = map_in_map_hash_table_ce;
+			class_name = "MapInMapHashTable";
 			break;
-		}
 		case BPF_MAP_TYPE_QUEUE:
-		case BPF_MAP_TYPE_STACK: {
-			if (!queue_stack_table_ce) {
-				zend_throw_error(NULL, "QueueStackTable class not found");
-				return retval;
-			}
-			object_init_ex(&retval, queue_stack_table_ce);
-			sc_zend_update_property_string(queue_stack_table_ce, &retval, "name", sizeof("name") - 1, table_name);
-			sub_object *table_obj = table_fetch_object(Z_OBJ(retval));
-			table_obj->bpf = &this->bpf;
-			Z_ADDREF(retval);
+		case BPF_MAP_TYPE_STACK:
+			ce = queue_stack_table_ce;
+			class_name = "QueueStackTable";
 			break;
-		}
-#ifdef BPF_MAP_TYPE_RINGBUF
-		case BPF_MAP_TYPE_RINGBUF: {
-			if (!ring_buf_table_ce) {
-				zend_throw_error(NULL, "RingBufTable class not found");
-				return retval;
-			}
-			object_init_ex(&retval, ring_buf_table_ce);
-			sc_zend_update_property_string(ring_buf_table_ce, &retval, "name", sizeof("name") - 1, table_name);
-			sub_object *table_obj = table_fetch_object(Z_OBJ(retval));
-			table_obj->bpf = &this->bpf;
-			Z_ADDREF(retval);
+		case BPF_MAP_TYPE_RINGBUF:
+			ce = ring_buf_table_ce;
+			class_name = "RingBufTable";
 			break;
-		}
-#endif
 		default:
 			if (from_attr) {
 				ZVAL_LONG(&retval, ttype);
@@ -397,9 +833,99 @@ zval EbpfExtension::get_table_cls(const char *table_name, int from_attr) {
 			return retval;
 	}
 
+	if (!ce) {
+		zend_throw_error(NULL, "%s class not found", class_name);
+		return retval;
+	}
+
+	object_init_ex(&retval, ce);
+	sc_zend_update_property_string(ce, &retval, "name", sizeof("name") - 1, table_name);
+	sub_object *table_obj = table_fetch_object(Z_OBJ(retval));
+	table_obj->bpf = &this->bpf;
+	table_obj->ext = this;
+	table_obj->desc = desc;
+	table_obj->parent = parent;
+	_wrappers.push_back(table_obj);
+
+	// The cache keeps its own reference, the caller gets the other one
+	add_assoc_zval(&_tables, table_name, &retval);
+	Z_ADDREF(retval);
 	return retval;
 }
 
+void *EbpfExtension::symcache(int pid) {
+	if (pid < 0)
+		pid = -1;
+	auto it = _symcaches.find(pid);
+	if (it != _symcaches.end())
+		return it->second;
+
+	// Same options as BPFStackTable: debug files checked, symbols loaded lazily
+	bcc_symbol_option option = {};
+	option.use_debug_file = 1;
+	option.check_debug_file_crc = 1;
+	option.lazy_symbolize = 1;
+	option.use_symbol_type = (1 << STT_FUNC) | (1 << STT_GNU_IFUNC);
+	void *cache = bcc_symcache_new(pid, &option);
+	_symcaches.emplace(pid, cache);
+	return cache;
+}
+
+std::vector<std::string> EbpfExtension::resolve_stack(const std::vector<uintptr_t> &addrs, int pid) {
+	std::vector<std::string> res;
+	if (addrs.empty())
+		return res;
+	res.reserve(addrs.size());
+
+	void *cache = symcache(pid);
+	bcc_symbol symbol;
+	for (auto addr: addrs) {
+		if (!cache || bcc_symcache_resolve(cache, addr, &symbol) != 0) {
+			res.emplace_back("[UNKNOWN]");
+		} else {
+			res.emplace_back(symbol.demangle_name);
+			bcc_symbol_free_demangle_name(&symbol);
+		}
+	}
+	return res;
+}
+
+void EbpfExtension::invalidate_symcache(int pid) {
+	if (pid < 0)
+		pid = -1;
+	auto it = _symcaches.find(pid);
+	if (it == _symcaches.end())
+		return;
+	if (it->second)
+		bcc_free_symcache(it->second, it->first);
+	_symcaches.erase(it);
+}
+
+void EbpfExtension::invalidate_symcaches() {
+	for (auto &it: _symcaches) {
+		if (it.second)
+			bcc_free_symcache(it.second, it.first);
+	}
+	_symcaches.clear();
+}
+
+bool EbpfExtension::refresh_symcache(int pid) {
+	if (pid < 0)
+		pid = -1;
+	auto it = _symcaches.find(pid);
+	if (it == _symcaches.end() || !it->second)
+		return false;
+	bcc_symcache_refresh(it->second);
+	return true;
+}
+
+void EbpfExtension::refresh_symcaches() {
+	for (auto &it: _symcaches) {
+		if (it.second)
+			bcc_symcache_refresh(it.second);
+	}
+}
+
 std::unordered_set<std::string> EbpfExtension::get_kprobe_functions(const std::string &event_re) {
 	std::unordered_set<std::string> blacklist;
 	std::unordered_set<std::string> avail_filter;
@@ -551,11 +1077,73 @@ zend_object *bpf_create_object(zend_class_entry *ce) {
 	return &intern->std;
 }
 
+/* Wrappers still referenced elsewhere when the Bpf goes away take over a
+   reference to it, so their native state stays valid until they are freed */
+void bpf_dtor_object(zend_object *object) {
+	zend_objects_destroy_object(object);
+
+	bpf_object *intern = bpf_fetch_object(object);
+	if (!intern->ebpf_cpp_cls) {
+		return;
+	}
+
+	HashTable *tables = Z_ARRVAL(intern->ebpf_cpp_cls->_tables);
+	zend_string *key;
+	zval *table;
+	ZEND_HASH_FOREACH_STR_KEY_VAL(tables, key, table) {
+		if (Z_REFCOUNT_P(table) == 1) {
+			continue;
+		}
+		sub_object *table_obj = table_fetch_object(Z_OBJ_P(table));
+		if (!table_obj->owns_parent) {
+			table_obj->owns_parent = true;
+			GC_ADDREF(object);
+		}
+		// Leaving the cache avoids a cycle; a buffer table stays the cookie
+		// of its buffer, kept alive by whoever still holds it
+		zend_hash_del(tables, key);
+	} ZEND_HASH_FOREACH_END();
+}
+
 void bpf_free_object(zend_object *object) {
 	bpf_object *intern = bpf_fetch_object(object);
+	if (intern->ebpf_cpp_cls) {
+		// The cycle collector may free tables after their Bpf, and the cache
+		// releases its own ones while the native state is torn down
+		for (sub_object *table: intern->ebpf_cpp_cls->_wrappers) {
+			table->ext = nullptr;
+			table->bpf = nullptr;
+		}
+		intern->ebpf_cpp_cls->_wrappers.clear();
+		intern->ebpf_cpp_cls->_buffers.clear();
+	}
+	// Detaches every probe and closes the buffers before the object goes away
+	delete intern->ebpf_cpp_cls;
+	intern->ebpf_cpp_cls = nullptr;
 	zend_object_std_dtor(&intern->std);
 }
 
+/* Cached tables hold callbacks, which may reference the Bpf, so the cache
+   is reported to the cycle collector */
+#if PHP_VERSION_ID >= 80000
+static HashTable *bpf_get_gc(zend_object *object, zval **table, int *n) {
+	HashTable *props = zend_std_get_properties(object);
+#else
+static HashTable *bpf_get_gc(zval *zobj, zval **table, int *n) {
+	zend_object *object = Z_OBJ_P(zobj);
+	HashTable *props = zend_std_get_properties(zobj);
+#endif
+	bpf_object *intern = bpf_fetch_object(object);
+	if (intern->ebpf_cpp_cls) {
+		*table = &intern->ebpf_cpp_cls->_tables;
+		*n = 1;
+	} else {
+		*table = NULL;
+		*n = 0;
+	}
+	return props;
+}
+
 zend_object *table_create_object(zend_class_entry *ce) {
 	sub_object *intern = (sub_object *) ecalloc(1, sizeof(sub_object) + zend_object_properties_size(ce));
 	zend_object_std_init(&intern->std, ce);
@@ -566,10 +1154,209 @@ zend_object *table_create_object(zend_class_entry *ce) {
 
 void table_free_object(zend_object *object) {
 	sub_object *intern = table_fetch_object(object);
+	table_unregister(intern);
+	perf_batch_free(intern->batch);
+	intern->batch = nullptr;
+	delete intern->key_schema;
+	delete intern->leaf_schema;
+	fcall_release(&intern->fci);
+	fcall_release(&intern->lost_fci);
+	delete intern->snapshot;
 	zend_object_std_dtor(&intern->std);
+	if (intern->owns_parent) {
+		OBJ_RELEASE(intern->parent);
+		intern->owns_parent = false;
+	}
+	intern->parent = nullptr;
 }
 
-/* {{{ PHP_INI
+#if PHP_VERSION_ID >= 80000
+static HashTable *table_get_gc(zend_object *object, zval **table, int *n) {
+	HashTable *props = zend_std_get_properties(object);
+#else
+static HashTable *table_get_gc(zval *zobj, zval **table, int *n) {
+	zend_object *object = Z_OBJ_P(zobj);
+	HashTable *props = zend_std_get_properties(zobj);
+#endif
+	sub_object *intern = table_fetch_object(object);
+	int count = 0;
+	if (intern->owns_parent) {
+		ZVAL_OBJ(&intern->gc_refs[count++], intern->parent);
+	}
+	if (ZEND_FCI_INITIALIZED(intern->fci)) {
+		ZVAL_COPY_VALUE(&intern->gc_refs[count++], &intern->fci.function_name);
+	}
+	if (ZEND_FCI_INITIALIZED(intern->lost_fci)) {
+		ZVAL_COPY_VALUE(&intern->gc_refs[count++], &intern->lost_fci.function_name);
+	}
+	*table = count ? intern->gc_refs : NULL;
+	*n = count;
+	return props;
+}
+
+zend_object *histogram_create_object(zend_class_entry *ce) {
+	histogram_object *intern = (histogram_object *) ecalloc(1, sizeof(histogram_object) +
+	                                                           zend_object_properties_size(ce));
+	intern->hist = new Histogram();
+	zend_object_std_init(&intern->std, ce);
+	object_properties_init(&intern->std, ce);
+	intern->std.handlers = &histogram_object_handlers;
+	return &intern->std;
+}
+
+void histogram_free_object(zend_object *object) {
+	histogram_object *intern = histogram_fetch_object(object);
+	delete intern->hist;
+	zend_object_std_dtor(&intern->std);
+}
+
+zend_object *profile_create_object(zend_class_entry *ce) {
+	profile_object *intern = (profile_object *) ecalloc(1, sizeof(profile_object) + zend_object_properties_size(ce));
+	intern->profile = new ProfileBuilder();
+	zend_object_std_init(&intern->std, ce);
+	object_properties_init(&intern->std, ce);
+	intern->std.handlers = &profile_object_handlers;
+	return &intern->std;
+}
+
+void profile_free_object(zend_object *object) {
+	profile_object *intern = profile_fetch_object(object);
+	delete intern->profile;
+	zend_object_std_dtor(&intern->std);
+}
+
+/* Iterator behind foreach over map tables. Entries are fetched one chunk at
+   a time, so memory stays bounded by the chunk and a loop can stop early */
+typedef struct _table_iterator {
+	zend_object_iterator intern;
+	ebpf::BPFTable *table;
+	ebpf::TableCursor cursor;
+	ebpf::TableDump dump;
+	size_t pos;
+	size_t leaf_size;
+	bool indexed;
+	zval current;
+} table_iterator;
+
+static void table_iterator_fetch(table_iterator *it) {
+	it->pos = 0;
+	do {
+		auto status = it->table->get_table_chunk(it->cursor, it->dump);
+		if (status.code() != 0) {
+			zend_throw_error(NULL, "Failed to iterate table: %s", status.msg().c_str());
+			it->cursor.done = true;
+			it->dump.count = 0;
+			return;
+		}
+	} while (it->dump.count == 0 && !it->cursor.done);
+}
+
+static void table_iterator_release_current(table_iterator *it) {
+	zval_ptr_dtor(&it->current);
+	ZVAL_UNDEF(&it->current);
+}
+
+static void table_iterator_dtor(zend_object_iterator *iter) {
+	table_iterator *it = (table_iterator *) iter;
+	zval_ptr_dtor(&it->current);
+	zval_ptr_dtor(&iter->data);
+	delete it->table;
+	/* The object store releases the memory itself once dtor returns */
+	it->~table_iterator();
+}
+
+static int table_iterator_valid(zend_object_iterator *iter) {
+	table_iterator *it = (table_iterator *) iter;
+	return it->pos < it->dump.count ? SUCCESS : FAILURE;
+}
+
+static zval *table_iterator_get_current_data(zend_object_iterator *iter) {
+	table_iterator *it = (table_iterator *) iter;
+	if (Z_ISUNDEF(it->current)) {
+		sub_object *obj = table_fetch_object(Z_OBJ(iter->data));
+		table_decode_value(obj->leaf_schema, it->leaf_size, it->table->is_percpu(),
+		                   it->dump.value(it->pos), it->dump.value_size, &it->current);
+	}
+	return &it->current;
+}
+
+static void table_iterator_get_current_key(zend_object_iterator *iter, zval *key) {
+	table_iterator *it = (table_iterator *) iter;
+	if (it->indexed) {
+		uint32_t index = 0;
+		memcpy(&index, it->dump.key(it->pos), std::min(sizeof(index), it->dump.key_size));
+		ZVAL_LONG(key, index);
+		return;
+	}
+	sub_object *obj = table_fetch_object(Z_OBJ(iter->data));
+	table_decode(obj->key_schema, it->dump.key(it->pos), it->dump.key_size, key);
+}
+
+static void table_iterator_move_forward(zend_object_iterator *iter) {
+	table_iterator *it = (table_iterator *) iter;
+	table_iterator_release_current(it);
+	if (++it->pos >= it->dump.count && !it->cursor.done) {
+		table_iterator_fetch(it);
+	}
+}
+
+static void table_iterator_rewind(zend_object_iterator *iter) {
+	table_iterator *it = (table_iterator *) iter;
+	table_iterator_release_current(it);
+	it->cursor = ebpf::TableCursor();
+	table_iterator_fetch(it);
+}
+
+static const zend_object_iterator_funcs table_iterator_funcs = {
+	table_iterator_dtor,
+	table_iterator_valid,
+	table_iterator_get_current_data,
+	table_iterator_get_current_key,
+	table_iterator_move_forward,
+	table_iterator_rewind,
+	NULL,
+#if PHP_VERSION_ID >= 80000
+	NULL,
+#endif
+};
+
+zend_object_iterator *table_get_iterator(zend_class_entry *ce, zval *object, int by_ref) {
+	if (by_ref) {
+		zend_throw_error(NULL, "Map tables cannot be iterated by reference");
+		return NULL;
+	}
+
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(object, &name, &desc);
+	if (!obj) {
+		return NULL;
+	}
+
+	table_iterator *it = new (emalloc(sizeof(table_iterator))) table_iterator();
+	zend_iterator_init(&it->intern);
+	ZVAL_COPY(&it->intern.data, object);
+	it->intern.funcs = (zend_object_iterator_funcs *) &table_iterator_funcs;
+	it->table = new ebpf::BPFTable(*desc);
+	it->pos = 0;
+	it->leaf_size = desc->leaf_size;
+	it->indexed = instanceof_function(ce, array_table_ce);
+	ZVAL_UNDEF(&it->current);
+	return &it->intern;
+}
+
+/* PHP 8 requires IteratorAggregate classes to have getIterator(), PHP 7
+   internal classes may implement Traversable with get_iterator alone */
+static void table_register_iterator(zend_class_entry *ce) {
+	ce->get_iterator = table_get_iterator;
+#if PHP_VERSION_ID >= 80000
+	zend_class_implements(ce, 1, zend_ce_aggregate);
+#else
+	zend_class_implements(ce, 1, zend_ce_traversable);
+#endif
+}
+
+/* {{{ PHP_INI
  */
 /* Remove comments and fill if you need to have entries in php.ini
 PHP_INI_BEGIN()
@@ -603,15 +1390,51 @@ PHP_METHOD (Bpf, __construct) {
 
 	bpf_object *obj = bpf_fetch_object(Z_OBJ_P(getThis()));
 	zval *text = zend_hash_str_find(Z_ARRVAL_P(opts), "text", strlen("text"));
+	zval *object = zend_hash_str_find(Z_ARRVAL_P(opts), "object", strlen("object"));
+
+	if (object && Z_TYPE_P(object) == IS_STRING) {
+		if (text) {
+			zend_throw_error(NULL, "The text and object options are exclusive");
+			RETURN_NULL();
+		}
+		if (!obj->ebpf_cpp_cls) {
+			zend_throw_error(NULL, "Invalid internal C++ object");
+			RETURN_NULL();
+		}
 
-	if (text && Z_TYPE_P(text) == IS_STRING) {
+		auto res = obj->ebpf_cpp_cls->init_object(std::string(Z_STRVAL_P(object), Z_STRLEN_P(object)));
+		if (res.code() != 0) {
+			zend_throw_error(NULL, "BPF object load failed: %s", res.msg().c_str());
+			RETURN_FALSE;
+		}
+		obj->ebpf_cpp_cls->_trace_autoload();
+	} else if (text && Z_TYPE_P(text) == IS_STRING) {
 		std::string source(Z_STRVAL_P(text), Z_STRLEN_P(text));
 		if (!obj->ebpf_cpp_cls) {
 			zend_throw_error(NULL, "Invalid internal C++ object");
 			RETURN_NULL();
 		}
 
-		auto res = obj->ebpf_cpp_cls->init(source);
+		std::vector<std::string> cflags;
+		zval *cflags_zv = zend_hash_str_find(Z_ARRVAL_P(opts), "cflags", strlen("cflags"));
+		if (cflags_zv && Z_TYPE_P(cflags_zv) == IS_ARRAY) {
+			zval *flag;
+			ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(cflags_zv), flag) {
+				if (Z_TYPE_P(flag) != IS_STRING) {
+					zend_throw_error(NULL, "cflags must be an array of strings");
+					RETURN_NULL();
+				}
+				cflags.emplace_back(Z_STRVAL_P(flag), Z_STRLEN_P(flag));
+			} ZEND_HASH_FOREACH_END();
+		}
+
+		std::string cache_dir;
+		zval *cache_zv = zend_hash_str_find(Z_ARRVAL_P(opts), "cache_dir", strlen("cache_dir"));
+		if (cache_zv && Z_TYPE_P(cache_zv) == IS_STRING) {
+			cache_dir.assign(Z_STRVAL_P(cache_zv), Z_STRLEN_P(cache_zv));
+		}
+
+		auto res = obj->ebpf_cpp_cls->init(source, cflags, cache_dir);
 		if (res.code() != 0) {
 			zend_throw_error(NULL, "BPF init failed: %s", res.msg().c_str());
 			RETURN_FALSE;
@@ -619,6 +1442,16 @@ PHP_METHOD (Bpf, __construct) {
 		obj->ebpf_cpp_cls->_trace_autoload();
 	}
 
+	zval *free_mem = zend_hash_str_find(Z_ARRVAL_P(opts), "free_bcc_memory", strlen("free_bcc_memory"));
+	if (free_mem && zend_is_true(free_mem) && obj->ebpf_cpp_cls) {
+		size_t reclaimed;
+		auto res = obj->ebpf_cpp_cls->free_bcc_memory(reclaimed);
+		if (res.code() != 0) {
+			zend_throw_error(NULL, "%s", res.msg().c_str());
+			RETURN_FALSE;
+		}
+	}
+
 	RETURN_TRUE;
 }
 
@@ -637,9 +1470,45 @@ PHP_METHOD (Bpf, __get) {
 	}
 
 	int from_attr = 1;
-	zval table = obj->ebpf_cpp_cls->get_table_cls(name, from_attr);
+	zval table = obj->ebpf_cpp_cls->get_table_cls(Z_OBJ_P(getThis()), name, from_attr);
+
+	RETURN_ZVAL(&table, 0, 0);
+}
+
+PHP_METHOD (Bpf, from_cache) {
+	bpf_object *obj = bpf_fetch_object(Z_OBJ_P(getThis()));
+	if (!obj || !obj->ebpf_cpp_cls) {
+		zend_throw_error(NULL, "Invalid object state");
+		RETURN_NULL();
+	}
+
+	RETURN_BOOL(obj->ebpf_cpp_cls->_from_cache);
+}
+
+PHP_METHOD (Bpf, free_bcc_memory) {
+	bpf_object *obj = bpf_fetch_object(Z_OBJ_P(getThis()));
+	if (!obj || !obj->ebpf_cpp_cls) {
+		zend_throw_error(NULL, "Invalid object state");
+		RETURN_NULL();
+	}
+
+	size_t reclaimed;
+	auto res = obj->ebpf_cpp_cls->free_bcc_memory(reclaimed);
+	if (res.code() != 0) {
+		zend_throw_error(NULL, "%s", res.msg().c_str());
+		RETURN_NULL();
+	}
+	RETURN_LONG((zend_long) reclaimed);
+}
+
+PHP_METHOD (Bpf, bcc_memory_reclaimed) {
+	bpf_object *obj = bpf_fetch_object(Z_OBJ_P(getThis()));
+	if (!obj || !obj->ebpf_cpp_cls) {
+		zend_throw_error(NULL, "Invalid object state");
+		RETURN_NULL();
+	}
 
-	RETURN_ZVAL(&table, 1, 0);
+	RETURN_LONG((zend_long) obj->ebpf_cpp_cls->_bcc_memory_reclaimed);
 }
 
 PHP_METHOD (Bpf, get_kprobe_functions) {
@@ -1060,35 +1929,98 @@ PHP_METHOD (Bpf, get_table) {
 	}
 
 	int from_fn = 0;
-	auto table = obj->ebpf_cpp_cls->get_table_cls(table_name, from_fn);
+	auto table = obj->ebpf_cpp_cls->get_table_cls(Z_OBJ_P(getThis()), table_name, from_fn);
 
 	if (Z_TYPE(table) == IS_NULL) {
 		RETURN_NULL();
 	}
 
-	RETURN_ZVAL(&table, 1, 0);
+	RETURN_ZVAL(&table, 0, 0);
 }
 
 PHP_METHOD (Bpf, perf_buffer_poll) {
+	zend_long timeout_ms = -1;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "|l", &timeout_ms) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	bpf_object *obj = bpf_fetch_object(Z_OBJ_P(getThis()));
+	if (!obj || !obj->ebpf_cpp_cls) {
+		zend_throw_error(NULL, "Invalid object state");
+		RETURN_NULL();
+	}
+
+	// Callbacks may open more buffers, so flush the tables that were open
+	// before the poll, held until their callbacks have returned
+	std::vector<sub_object *> tables(obj->ebpf_cpp_cls->_buffers);
+	zend_ulong received = 0;
+	for (sub_object *table_obj: tables) {
+		GC_ADDREF(&table_obj->std);
+		received -= table_obj->received;
+	}
+
+	// One epoll set covers every open perf buffer and ring buffer
+	int res = obj->ebpf_cpp_cls->bpf.poll_buffers((int) timeout_ms);
+
+	for (sub_object *table_obj: tables) {
+		perf_batch_flush(table_obj);
+		received += table_obj->received;
+	}
+	for (sub_object *table_obj: tables) {
+		OBJ_RELEASE(&table_obj->std);
+	}
+
+	if (res < 0) {
+		if (!EG(exception)) {
+			zend_throw_error(NULL, "perf buffer poll error: no perf buffer opened or poll failed");
+		}
+		RETURN_NULL();
+	}
+
+	RETURN_LONG((zend_long) received);
+}
+
+PHP_METHOD (Bpf, ring_buffer_poll) {
+	zend_long timeout_ms = -1;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "|l", &timeout_ms) == FAILURE) {
+		RETURN_NULL();
+	}
+
 	bpf_object *obj = bpf_fetch_object(Z_OBJ_P(getThis()));
 	if (!obj || !obj->ebpf_cpp_cls) {
 		zend_throw_error(NULL, "Invalid object state");
 		RETURN_NULL();
 	}
 
-	zval *name_zv = sc_zend_read_property(perf_event_array_table_ce, &obj->ebpf_cpp_cls->_class_perf_event_obj, "name",
-	                                      sizeof("name") - 1, 0);
+	int res = obj->ebpf_cpp_cls->bpf.poll_ring_buffer((int) timeout_ms);
+	if (res < 0) {
+		if (!EG(exception)) {
+			zend_throw_error(NULL, "ring buffer poll error: no ring buffer opened or poll failed (%d)", res);
+		}
+		RETURN_NULL();
+	}
+
+	RETURN_LONG(res);
+}
 
-	if (!name_zv || Z_TYPE_P(name_zv) != IS_STRING) {
-		zend_throw_error(NULL, "Invalid or missing name property");
+PHP_METHOD (Bpf, ring_buffer_consume) {
+	bpf_object *obj = bpf_fetch_object(Z_OBJ_P(getThis()));
+	if (!obj || !obj->ebpf_cpp_cls) {
+		zend_throw_error(NULL, "Invalid object state");
 		RETURN_NULL();
 	}
-	int timeout_ms = -1;
-	int res = obj->ebpf_cpp_cls->bpf.poll_perf_buffer(std::string(Z_STRVAL_P(name_zv), Z_STRLEN_P(name_zv)),
-	                                                  timeout_ms);
+
+	int res = obj->ebpf_cpp_cls->bpf.consume_ring_buffer();
 	if (res < 0) {
-		zend_throw_error(NULL, "perf buffer poll error.");
+		if (!EG(exception)) {
+			zend_throw_error(NULL, "ring buffer consume error: no ring buffer opened or consume failed (%d)", res);
+		}
+		RETURN_NULL();
 	}
+
+	RETURN_LONG(res);
 }
 
 PHP_METHOD (Bpf, get_syscall_fnname) {
@@ -1110,6 +2042,46 @@ PHP_METHOD (Bpf, get_syscall_fnname) {
 	RETURN_STRING(result.c_str());
 }
 
+/* Shared body of Bpf::invalidate_symcache() and refresh_symcache(): one
+   process when a pid is given, every cached one otherwise */
+static void bpf_symcache_op(INTERNAL_FUNCTION_PARAMETERS, bool refresh) {
+	zend_long pid = 0;
+	zend_bool pid_is_null = 1;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "|l!", &pid, &pid_is_null) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	bpf_object *obj = bpf_fetch_object(Z_OBJ_P(getThis()));
+	if (!obj || !obj->ebpf_cpp_cls) {
+		zend_throw_error(NULL, "Invalid object state");
+		RETURN_NULL();
+	}
+
+	EbpfExtension *ext = obj->ebpf_cpp_cls;
+	if (pid_is_null) {
+		if (refresh) {
+			ext->refresh_symcaches();
+		} else {
+			ext->invalidate_symcaches();
+		}
+		RETURN_TRUE;
+	}
+	if (refresh) {
+		RETURN_BOOL(ext->refresh_symcache((int) pid));
+	}
+	ext->invalidate_symcache((int) pid);
+	RETURN_TRUE;
+}
+
+PHP_METHOD (Bpf, invalidate_symcache) {
+	bpf_symcache_op(INTERNAL_FUNCTION_PARAM_PASSTHRU, false);
+}
+
+PHP_METHOD (Bpf, refresh_symcache) {
+	bpf_symcache_op(INTERNAL_FUNCTION_PARAM_PASSTHRU, true);
+}
+
 PHP_METHOD (Bpf, load_func) {
 	char *fn;
 	size_t fn_len;
@@ -1193,359 +2165,2039 @@ PHP_METHOD (Bpf, attach_raw_socket) {
 }
 
 PHP_METHOD (PerfEventArrayTable, open_perf_buffer) {
-	char *cb_fn_str = NULL;
-	size_t cb_fn_len = 0;
+	zend_fcall_info fci = empty_fcall_info;
+	zend_fcall_info_cache fcc = empty_fcall_info_cache;
+	zval *options = NULL;
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS(), "s", &cb_fn_str, &cb_fn_len) == FAILURE) {
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "f|a", &fci, &fcc, &options) == FAILURE) {
 		RETURN_NULL();
 	}
 
-	zval *name_zv = sc_zend_read_property(Z_OBJCE_P(getThis()), getThis(), "name",
-	                                      sizeof("name") - 1, 0);
+	zend_long batch_size = 0;
+	zend_long page_cnt = DEFAULT_PERF_BUFFER_PAGE_CNT;
+	zend_fcall_info lost_fci = empty_fcall_info;
+	zend_fcall_info_cache lost_fcc = empty_fcall_info_cache;
+	if (options && Z_TYPE_P(options) == IS_ARRAY) {
+		zval *tmp;
+
+		if ((tmp = zend_hash_str_find(Z_ARRVAL_P(options), "batch_size", strlen("batch_size"))) != NULL) {
+			batch_size = zval_get_long(tmp);
+			if (batch_size < 0 || batch_size > PERF_BUFFER_MAX_BATCH_SIZE) {
+				zend_throw_error(NULL, "batch_size must be between 0 and %d", PERF_BUFFER_MAX_BATCH_SIZE);
+				RETURN_NULL();
+			}
+		}
+
+		if ((tmp = zend_hash_str_find(Z_ARRVAL_P(options), "page_cnt", strlen("page_cnt"))) != NULL) {
+			page_cnt = zval_get_long(tmp);
+			if (page_cnt <= 0) {
+				zend_throw_error(NULL, "page_cnt must be a positive power of two");
+				RETURN_NULL();
+			}
+		}
+
+		if ((tmp = zend_hash_str_find(Z_ARRVAL_P(options), "lost_cb", strlen("lost_cb"))) != NULL) {
+			if (zend_fcall_info_init(tmp, 0, &lost_fci, &lost_fcc, NULL, NULL) == FAILURE) {
+				zend_throw_error(NULL, "lost_cb must be a valid callback");
+				RETURN_NULL();
+			}
+		}
+	}
+
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
+		RETURN_NULL();
+	}
 
-	if (!name_zv || Z_TYPE_P(name_zv) != IS_STRING) {
-		zend_throw_error(NULL, "Invalid or missing name property");
+	perf_buffer_batch *batch = obj->batch;
+	obj->batch = batch_size > 0 ? perf_batch_new(batch_size) : nullptr;
+	// Without a lost_cb, BCC keeps reporting drops on stderr
+	auto res = obj->bpf->open_perf_buffer(name, callbackfn, ZEND_FCI_INITIALIZED(lost_fci) ? lostcbfn : nullptr,
+	                                      obj, (int) page_cnt);
+	if (res.code() != 0) {
+		perf_batch_free(obj->batch);
+		obj->batch = batch;
+		zend_throw_error(NULL, "open_perf_buffer error: %s", res.msg().c_str());
 		RETURN_NULL();
 	}
 
-	const char *name = Z_STRVAL_P(name_zv);
-	cb_fn = std::string(cb_fn_str, cb_fn_len);
+	perf_batch_free(batch);
+	table_register_buffer(obj);
+	fcall_store(&obj->fci, &obj->fcc, &fci, &fcc);
+	if (ZEND_FCI_INITIALIZED(lost_fci)) {
+		fcall_store(&obj->lost_fci, &obj->lost_fcc, &lost_fci, &lost_fcc);
+	} else {
+		fcall_release(&obj->lost_fci);
+	}
+	obj->perf_buffer = obj->bpf->get_perf_buffer(name);
+
+	RETURN_TRUE;
+}
 
+PHP_METHOD (PerfEventArrayTable, stats) {
 	sub_object *obj = table_fetch_object(Z_OBJ_P(getThis()));
 	if (!obj || !obj->bpf) {
 		zend_throw_error(NULL, "Invalid object state");
 		RETURN_NULL();
 	}
 
-	auto res = obj->bpf->open_perf_buffer(name, callbackfn);
+	array_init(return_value);
+	if (!obj->perf_buffer) {
+		return;
+	}
+
+	for (const auto &it: obj->perf_buffer->get_cpu_stats()) {
+		zval cpu;
+		array_init(&cpu);
+		add_assoc_long(&cpu, "received", (zend_long) it.second.received);
+		add_assoc_long(&cpu, "lost", (zend_long) it.second.lost);
+		add_index_zval(return_value, it.first, &cpu);
+	}
+}
+
+PHP_METHOD (RingBufTable, open_ring_buffer) {
+	zend_fcall_info fci = empty_fcall_info;
+	zend_fcall_info_cache fcc = empty_fcall_info_cache;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "f", &fci, &fcc) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
+		RETURN_NULL();
+	}
+
+	auto res = obj->bpf->open_ring_buffer(name, ringbuf_callbackfn, obj);
 	if (res.code() != 0) {
-		zend_throw_error(NULL, "open_perf_buffer error: %s", res.msg().c_str());
+		zend_throw_error(NULL, "open_ring_buffer error: %s", res.msg().c_str());
 		RETURN_NULL();
 	}
 
+	table_register_buffer(obj);
+	fcall_store(&obj->fci, &obj->fcc, &fci, &fcc);
+
 	RETURN_TRUE;
 }
 
 PHP_METHOD (HashTable, values) {
-	zval *name_zv = sc_zend_read_property(Z_OBJCE_P(getThis()), getThis(), "name",
-	                                      sizeof("name") - 1, 0);
+	zval *options = NULL;
 
-	if (!name_zv || Z_TYPE_P(name_zv) != IS_STRING) {
-		zend_throw_error(NULL, "Invalid or missing name property");
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "|a", &options) == FAILURE) {
 		RETURN_NULL();
 	}
 
-	sub_object *obj = table_fetch_object(Z_OBJ_P(getThis()));
-	if (!obj || !obj->bpf) {
-		zend_throw_error(NULL, "Invalid object state");
+	size_t chunk_size;
+	if (!table_dump_options(options, &chunk_size)) {
+		RETURN_NULL();
+	}
+
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
 		RETURN_NULL();
 	}
 
-	std::vector<std::pair<std::vector<char>, std::vector<char>>> entries;
-	auto table = obj->bpf->get_table(Z_STRVAL_P(name_zv));
-	auto status = table.get_table_offline_ptr(entries);
+	ebpf::TableDump dump;
+	ebpf::BPFTable table(*desc);
+	auto status = table.get_table_offline_batch(dump, chunk_size);
 
 	if (status.code() != 0) {
 		zend_throw_error(NULL, "Failed to get table values: %s", status.msg().c_str());
 		RETURN_NULL();
 	}
 
-	array_init(return_value);
-
-	for (const auto &pair: entries) {
-		const auto &key_data = pair.first;
-		const auto &val_data = pair.second;
-		zval entry;
-		array_init(&entry);
-		add_assoc_stringl(&entry, "key", key_data.data(), key_data.size());
-		add_assoc_stringl(&entry, "value", val_data.data(), val_data.size());
-		add_next_index_zval(return_value, &entry);
-	}
+	table_dump_entries(obj, desc, table.is_percpu(), dump, return_value);
 }
 
-PHP_METHOD (HashTable, clear) {
-	zval *name_zv = sc_zend_read_property(Z_OBJCE_P(getThis()), getThis(), "name",
-	                                      sizeof("name") - 1, 0);
+PHP_METHOD (HashTable, values_packed) {
+	zval *options = NULL;
 
-	if (!name_zv || Z_TYPE_P(name_zv) != IS_STRING) {
-		zend_throw_error(NULL, "Invalid or missing name property");
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "|a", &options) == FAILURE) {
 		RETURN_NULL();
 	}
-	sub_object *obj = table_fetch_object(Z_OBJ_P(getThis()));
-	if (!obj || !obj->bpf) {
-		zend_throw_error(NULL, "Invalid object state");
+
+	size_t chunk_size;
+	if (!table_dump_options(options, &chunk_size)) {
 		RETURN_NULL();
 	}
 
-	auto table = obj->bpf->get_table(Z_STRVAL_P(name_zv));
-	auto res = table.clear_table_non_atomic();
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
+		RETURN_NULL();
+	}
 
-	if (res.code() != 0) {
-		zend_throw_error(NULL, "Failed to clear table: %s", res.msg().c_str());
+	ebpf::TableDump dump;
+	ebpf::BPFTable table(*desc);
+	auto status = table.get_table_offline_batch(dump, chunk_size);
+
+	if (status.code() != 0) {
+		zend_throw_error(NULL, "Failed to get table values: %s", status.msg().c_str());
 		RETURN_NULL();
 	}
 
-	RETURN_TRUE;
+	array_init_size(return_value, 5);
+	add_assoc_long(return_value, "count", (zend_long) dump.count);
+	add_assoc_long(return_value, "key_size", (zend_long) dump.key_size);
+	add_assoc_long(return_value, "value_size", (zend_long) dump.value_size);
+	add_assoc_stringl(return_value, "keys", dump.keys.data(), dump.keys.size());
+	add_assoc_stringl(return_value, "values", dump.values.data(), dump.values.size());
 }
 
-PHP_METHOD (ArrayTable, get_value) {
-	zend_long index;
-//	zval name_rv;
-//	zval *name_zv;
+PHP_METHOD (HashTable, drain) {
+	zval *options = NULL;
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS(), "l", &index) == FAILURE) {
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "|a", &options) == FAILURE) {
 		RETURN_NULL();
 	}
-	zval *name_zv = sc_zend_read_property(Z_OBJCE_P(getThis()), getThis(), "name",
-	                                      sizeof("name") - 1, 0);
 
-	if (!name_zv || Z_TYPE_P(name_zv) != IS_STRING) {
-		zend_throw_error(NULL, "Invalid or missing name property");
+	size_t chunk_size;
+	if (!table_dump_options(options, &chunk_size)) {
 		RETURN_NULL();
 	}
 
-	sub_object *obj = table_fetch_object(Z_OBJ_P(getThis()));
-	if (!obj || !obj->bpf) {
-		zend_throw_error(NULL, "Invalid object state");
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
 		RETURN_NULL();
 	}
 
-	try {
-		auto table = obj->bpf->get_array_table<uint64_t>(Z_STRVAL_P(name_zv));
-		uint64_t val;
-		auto res = table.get_value(index, val);
-		if (res.code() != 0) {
-			zend_throw_error(NULL, "Get value error in %s", Z_STRVAL_P(name_zv));
-			RETURN_NULL();
-		}
-		RETURN_LONG(val);
-	} catch (const std::exception &e) {
-		zend_throw_error(NULL, "Exception: %s", e.what());
+	ebpf::TableDump dump;
+	ebpf::BPFTable table(*desc);
+	auto status = table.drain_table_batch(dump, chunk_size);
+
+	if (status.code() != 0 && dump.count == 0) {
+		zend_throw_error(NULL, "Failed to drain table: %s", status.msg().c_str());
+		RETURN_NULL();
+	}
+
+	// Entries drained before a failure are already gone from the map, so
+	// they are returned rather than dropped with the error
+	table_dump_entries(obj, desc, table.is_percpu(), dump, return_value);
+	if (status.code() != 0) {
+		php_error_docref(NULL, E_WARNING, "Table drained partially (%zu entries): %s", dump.count,
+		                 status.msg().c_str());
+	}
+}
+
+PHP_METHOD (HashTable, clear) {
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
+		RETURN_NULL();
+	}
+
+	ebpf::BPFTable table(*desc);
+	auto res = table.clear_table_non_atomic();
+
+	if (res.code() != 0) {
+		zend_throw_error(NULL, "Failed to clear table: %s", res.msg().c_str());
+		RETURN_NULL();
+	}
+
+	RETURN_TRUE;
+}
+
+/* Pack the keys of a PHP array back to back, in iteration order */
+static bool table_encode_keys(sub_object *obj, const ebpf::TableDesc *desc, zval *keys, std::vector<char> &out) {
+	std::string err;
+	size_t i = 0;
+	zval *key;
+
+	out.resize(zend_hash_num_elements(Z_ARRVAL_P(keys)) * desc->key_size);
+	ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(keys), key) {
+		if (!table_encode(obj->key_schema, key, out.data() + i * desc->key_size, desc->key_size, err)) {
+			zend_throw_error(NULL, "Invalid key #%zu: %s", i, err.c_str());
+			return false;
+		}
+		i++;
+	} ZEND_HASH_FOREACH_END();
+	return true;
+}
+
+PHP_METHOD (HashTable, get) {
+	zval *key;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "z", &key) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
+		RETURN_NULL();
+	}
+
+	ebpf::BPFTable table(*desc);
+	std::vector<char> k(desc->key_size), v(table.get_value_size());
+	std::string err;
+	if (!table_encode(obj->key_schema, key, k.data(), k.size(), err)) {
+		zend_throw_error(NULL, "Invalid key: %s", err.c_str());
+		RETURN_NULL();
+	}
+
+	if (!table.lookup_raw(k.data(), v.data())) {
+		if (errno != ENOENT) {
+			zend_throw_error(NULL, "Failed to get value: %s", strerror(errno));
+		}
+		RETURN_NULL();
+	}
+
+	table_decode_value(obj->leaf_schema, desc->leaf_size, table.is_percpu(), v.data(), v.size(), return_value);
+}
+
+PHP_METHOD (HashTable, set) {
+	zval *key;
+	zval *value;
+	zend_long flags = BPF_ANY;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "zz|l", &key, &value, &flags) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
+		RETURN_NULL();
+	}
+
+	ebpf::BPFTable table(*desc);
+	std::vector<char> k(desc->key_size), v(table.get_value_size());
+	std::string err;
+	if (!table_encode(obj->key_schema, key, k.data(), k.size(), err)) {
+		zend_throw_error(NULL, "Invalid key: %s", err.c_str());
+		RETURN_NULL();
+	}
+	if (!table_encode_value(obj->leaf_schema, desc->leaf_size, table.is_percpu(), value, v.data(), v.size(), err)) {
+		zend_throw_error(NULL, "Invalid value: %s", err.c_str());
+		RETURN_NULL();
+	}
+
+	if (!table.update_raw(k.data(), v.data(), flags)) {
+		// Bpf::NOEXIST / Bpf::EXIST conditions that did not hold
+		if (errno == EEXIST || errno == ENOENT) {
+			RETURN_FALSE;
+		}
+		zend_throw_error(NULL, "Failed to set value: %s", strerror(errno));
+		RETURN_NULL();
+	}
+
+	RETURN_TRUE;
+}
+
+PHP_METHOD (HashTable, delete) {
+	zval *key;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "z", &key) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
+		RETURN_NULL();
+	}
+
+	ebpf::BPFTable table(*desc);
+	std::vector<char> k(desc->key_size);
+	std::string err;
+	if (!table_encode(obj->key_schema, key, k.data(), k.size(), err)) {
+		zend_throw_error(NULL, "Invalid key: %s", err.c_str());
+		RETURN_NULL();
+	}
+
+	if (!table.remove_raw(k.data())) {
+		if (errno == ENOENT) {
+			RETURN_FALSE;
+		}
+		zend_throw_error(NULL, "Failed to delete value: %s", strerror(errno));
+		RETURN_NULL();
+	}
+
+	RETURN_TRUE;
+}
+
+PHP_METHOD (HashTable, exists) {
+	zval *key;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "z", &key) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
+		RETURN_NULL();
+	}
+
+	ebpf::BPFTable table(*desc);
+	std::vector<char> k(desc->key_size), v(table.get_value_size());
+	std::string err;
+	if (!table_encode(obj->key_schema, key, k.data(), k.size(), err)) {
+		zend_throw_error(NULL, "Invalid key: %s", err.c_str());
+		RETURN_NULL();
+	}
+
+	RETURN_BOOL(table.lookup_raw(k.data(), v.data()));
+}
+
+PHP_METHOD (HashTable, get_many) {
+	zval *keys;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "a", &keys) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
+		RETURN_NULL();
+	}
+
+	ebpf::BPFTable table(*desc);
+	std::vector<char> packed;
+	if (!table_encode_keys(obj, desc, keys, packed)) {
+		RETURN_NULL();
+	}
+
+	// The kernel has no keyed batch lookup; the loop stays native, one syscall per key
+	std::vector<char> v(table.get_value_size());
+	bool percpu = table.is_percpu();
+	zend_ulong index;
+	zend_string *str_key;
+	size_t i = 0;
+
+	array_init_size(return_value, zend_hash_num_elements(Z_ARRVAL_P(keys)));
+	ZEND_HASH_FOREACH_KEY(Z_ARRVAL_P(keys), index, str_key) {
+		zval value;
+		if (table.lookup_raw(packed.data() + i * desc->key_size, v.data())) {
+			table_decode_value(obj->leaf_schema, desc->leaf_size, percpu, v.data(), v.size(), &value);
+		} else if (errno == ENOENT) {
+			ZVAL_NULL(&value);
+		} else {
+			zend_throw_error(NULL, "Failed to get value: %s", strerror(errno));
+			zval_ptr_dtor(return_value);
+			RETURN_NULL();
+		}
+		if (str_key) {
+			zend_hash_update(Z_ARRVAL_P(return_value), str_key, &value);
+		} else {
+			zend_hash_index_update(Z_ARRVAL_P(return_value), index, &value);
+		}
+		i++;
+	} ZEND_HASH_FOREACH_END();
+}
+
+PHP_METHOD (HashTable, set_many) {
+	zval *keys;
+	zval *values;
+	zend_long flags = BPF_ANY;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "aa|l", &keys, &values, &flags) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	if (zend_hash_num_elements(Z_ARRVAL_P(keys)) != zend_hash_num_elements(Z_ARRVAL_P(values))) {
+		zend_throw_error(NULL, "set_many expects as many values as keys");
+		RETURN_NULL();
+	}
+
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
+		RETURN_NULL();
+	}
+
+	ebpf::BPFTable table(*desc);
+	std::vector<char> packed_keys;
+	if (!table_encode_keys(obj, desc, keys, packed_keys)) {
+		RETURN_NULL();
+	}
+
+	size_t count = zend_hash_num_elements(Z_ARRVAL_P(values));
+	size_t value_size = table.get_value_size();
+	std::vector<char> packed_values(count * value_size);
+	bool percpu = table.is_percpu();
+	std::string err;
+	size_t i = 0;
+	zval *value;
+	ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(values), value) {
+		if (!table_encode_value(obj->leaf_schema, desc->leaf_size, percpu, value,
+		                        packed_values.data() + i * value_size, value_size, err)) {
+			zend_throw_error(NULL, "Invalid value #%zu: %s", i, err.c_str());
+			RETURN_NULL();
+		}
+		i++;
+	} ZEND_HASH_FOREACH_END();
+
+	if (flags == BPF_ANY) {
+		auto res = table.update_batch(packed_keys.data(), packed_values.data(), count);
+		if (res.code() != 0) {
+			zend_throw_error(NULL, "Failed to set values: %s", res.msg().c_str());
+			RETURN_NULL();
+		}
+		RETURN_LONG((zend_long) count);
+	}
+
+	// BPF_MAP_UPDATE_BATCH takes no per-element flags, conditional writes go key by key
+	zend_long written = 0;
+	for (i = 0; i < count; i++) {
+		if (table.update_raw(packed_keys.data() + i * desc->key_size, packed_values.data() + i * value_size, flags)) {
+			written++;
+		} else if (errno != EEXIST && errno != ENOENT) {
+			zend_throw_error(NULL, "Failed to set value: %s", strerror(errno));
+			RETURN_NULL();
+		}
+	}
+	RETURN_LONG(written);
+}
+
+PHP_METHOD (HashTable, delete_many) {
+	zval *keys;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "a", &keys) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
+		RETURN_NULL();
+	}
+
+	ebpf::BPFTable table(*desc);
+	std::vector<char> packed;
+	if (!table_encode_keys(obj, desc, keys, packed)) {
+		RETURN_NULL();
+	}
+
+	size_t deleted = 0;
+	auto res = table.delete_batch(packed.data(), zend_hash_num_elements(Z_ARRVAL_P(keys)), deleted);
+	if (res.code() != 0) {
+		zend_throw_error(NULL, "Failed to delete values: %s", res.msg().c_str());
+		RETURN_NULL();
+	}
+
+	RETURN_LONG((zend_long) deleted);
+}
+
+#if PHP_VERSION_ID >= 80000
+PHP_METHOD (HashTable, getIterator) {
+	if (zend_parse_parameters_none() == FAILURE) {
+		RETURN_NULL();
+	}
+
+	zend_create_internal_iterator_zval(return_value, getThis());
+}
+#endif
+
+PHP_METHOD (HashTable, set_schema) {
+	zval *leaf = NULL;
+	zval *key = NULL;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "|zz", &leaf, &key) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
+		RETURN_NULL();
+	}
+
+	std::string err;
+	TableSchema *leaf_schema = nullptr, *key_schema = nullptr;
+	if (!table_build_schema(obj, name, leaf, false, &leaf_schema, err) ||
+	    !table_build_schema(obj, name, key, true, &key_schema, err)) {
+		delete leaf_schema;
+		zend_throw_error(NULL, "set_schema error: %s", err.c_str());
+		RETURN_NULL();
+	}
+
+	delete obj->leaf_schema;
+	delete obj->key_schema;
+	obj->leaf_schema = leaf_schema;
+	obj->key_schema = key_schema;
+
+	RETURN_TRUE;
+}
+
+PHP_METHOD (ArrayTable, get_value) {
+	zend_long index;
+//	zval name_rv;
+//	zval *name_zv;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "l", &index) == FAILURE) {
+		RETURN_NULL();
+	}
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
+		RETURN_NULL();
+	}
+
+	try {
+		ebpf::BPFArrayTable<uint64_t> table(*desc);
+		uint64_t val;
+		auto res = table.get_value(index, val);
+		if (res.code() != 0) {
+			zend_throw_error(NULL, "Get value error in %s", name);
+			RETURN_NULL();
+		}
+		RETURN_LONG(val);
+	} catch (const std::exception &e) {
+		zend_throw_error(NULL, "Exception: %s", e.what());
+		RETURN_NULL();
+	}
+}
+
+PHP_METHOD (ArrayTable, values) {
+	zval *options = NULL;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "|a", &options) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	size_t chunk_size;
+	if (!table_dump_options(options, &chunk_size)) {
+		RETURN_NULL();
+	}
+
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
+		RETURN_NULL();
+	}
+
+	ebpf::TableDump dump;
+	ebpf::BPFTable table(*desc);
+	auto status = table.get_table_offline_batch(dump, chunk_size);
+
+	if (status.code() != 0) {
+		zend_throw_error(NULL, "Failed to get table values: %s", status.msg().c_str());
+		RETURN_NULL();
+	}
+
+	array_init_size(return_value, (uint32_t) dump.count);
+
+	for (size_t i = 0; i < dump.count; i++) {
+		uint32_t index = 0;
+		memcpy(&index, dump.key(i), std::min(sizeof(index), dump.key_size));
+		zval value;
+		table_decode(obj->leaf_schema, dump.value(i), dump.value_size, &value);
+		add_index_zval(return_value, index, &value);
+	}
+}
+
+/* Render log2 slots the way bcc's print_log2_hist() does, appending to out.
+   Slot i counts values in [2^(i-1), 2^i - 1]; false when every slot is empty */
+static bool histogram_render_log2(const std::vector<uint64_t> &vals, const std::string &header, std::string &out) {
+	int idx_max = -1;
+	uint64_t val_max = 0;
+
+	for (size_t i = 0; i < vals.size(); ++i) {
+		if (vals[i] > 0) {
+			idx_max = static_cast<int>(i);
+			if (vals[i] > val_max) val_max = vals[i];
+		}
+	}
+
+	if (idx_max == -1) {
+		out += "No data to display.\n";
+		return false;
+	}
+
+	int stars_max = 40;
+	bool long_format = idx_max > 32;
+	int num_width = long_format ? 20 : 10;
+
+	int col1_width = long_format ? 41 : 27;
+	int label_width = col1_width - 2;
+
+	// Every row is the same width, so one reservation covers the whole table
+	out.reserve(out.size() + header.size() + label_width + 32 +
+	            (size_t) idx_max * (2 * num_width + stars_max + 24));
+
+	int padding = label_width - (int) header.size();
+	if (padding > 0) {
+		out.append(padding / 2, ' ');
+		out += header;
+		out.append(padding - padding / 2, ' ');
+	} else {
+		out += header;
+	}
+	out += ": count    distribution\n";
+
+	char row[160];
+	bool strip_leading_zero = true;
+	for (int i = 1; i <= idx_max; ++i) {
+		uint64_t low = (1ULL << (i - 1));
+		uint64_t high = (1ULL << i) - 1;
+		if (low == high) low -= 1;
+
+		uint64_t val = vals[i];
+		if (strip_leading_zero && val == 0) {
+			continue;
+		}
+		strip_leading_zero = false;
+
+		char bar[64];
+		int limit = std::min(stars_max, static_cast<int>((double) val * stars_max / val_max));
+		memset(bar, '*', limit);
+		bar[limit] = '\0';
+
+		int len = snprintf(row, sizeof(row), "%*llu -> %-*llu : %-8llu|%s|\n",
+		                   num_width, (unsigned long long) low, num_width, (unsigned long long) high,
+		                   (unsigned long long) val, bar);
+		out.append(row, std::min((size_t) len, sizeof(row) - 1));
+	}
+	return true;
+}
+
+/* Render linear slots the way bcc's print_linear_hist() does, one row per non-empty slot */
+static bool histogram_render_linear(const std::vector<uint64_t> &res, const std::string &header, std::string &out) {
+	if (res.empty()) {
+		out += "empty histogram\n";
+		return false;
+	}
+
+	uint64_t max_val = *std::max_element(res.begin(), res.end());
+	if (max_val == 0) max_val = 1;
+
+	int stars_max = 40;
+	size_t rows = (size_t) std::count_if(res.begin(), res.end(), [](uint64_t v) { return v != 0; });
+	out.reserve(out.size() + header.size() + 40 + rows * (stars_max + 40));
+
+	out += "    ";
+	out += header;
+	if (header.size() < 12) {
+		out.append(12 - header.size(), ' ');
+	}
+	out += ": count    distribution\n";
+
+	char row[160];
+	int len;
+
+	for (size_t i = 0; i < res.size(); ++i) {
+		if (res[i] == 0) continue;
+
+		char bar[64];
+		int limit = std::min(stars_max, static_cast<int>((double) res[i] * stars_max / max_val));
+		memset(bar, '*', limit);
+		bar[limit] = '\0';
+
+		char count_str[32];
+		snprintf(count_str, sizeof(count_str), ": %llu", (unsigned long long) res[i]);
+		len = snprintf(row, sizeof(row), "    %-12zu%-10s|%s|\n", i, count_str, bar);
+		out.append(row, std::min((size_t) len, sizeof(row) - 1));
+	}
+	return true;
+}
+
+/* Write rendered text with a single call, to PHP's output layer or to the
+   stream resource given by the caller */
+static bool histogram_output(zval *zstream, const std::string &text) {
+	if (!zstream || Z_TYPE_P(zstream) == IS_NULL) {
+		PHPWRITE(text.data(), text.size());
+		return true;
+	}
+
+	if (Z_TYPE_P(zstream) != IS_RESOURCE) {
+		zend_throw_error(NULL, "Output must be a stream resource");
+		return false;
+	}
+
+	php_stream *stream;
+	php_stream_from_zval_no_verify(stream, zstream);
+	if (!stream) {
+		zend_throw_error(NULL, "Output must be a stream resource");
+		return false;
+	}
+	if ((size_t) php_stream_write(stream, text.data(), text.size()) != text.size()) {
+		zend_throw_error(NULL, "Failed to write histogram");
+		return false;
+	}
+	return true;
+}
+
+/* Target of print_*_hist(), from the "stream" option; none means the output buffer */
+static zval *histogram_stream_option(zval *options) {
+	return options ? zend_hash_str_find(Z_ARRVAL_P(options), "stream", strlen("stream")) : NULL;
+}
+
+/* Shared body of ArrayTable::print_*_hist() and format_*_hist(). print_*
+   takes the target stream from the "stream" option, like HashTable */
+static void array_table_render_hist(INTERNAL_FUNCTION_PARAMETERS, bool linear, bool to_string) {
+	char *header;
+	size_t header_len;
+	zval *options = NULL;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), to_string ? "s" : "s|a", &header, &header_len, &options) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
+		RETURN_NULL();
+	}
+
+	ebpf::BPFArrayTable<uint64_t> table(*desc);
+	auto vals = table.get_table_offline();
+
+	std::string text;
+	std::string head(header, header_len);
+	bool shown = linear ? histogram_render_linear(vals, head, text) : histogram_render_log2(vals, head, text);
+
+	if (to_string) {
+		RETURN_STRINGL(text.data(), text.size());
+	}
+	if (!histogram_output(histogram_stream_option(options), text)) {
+		RETURN_NULL();
+	}
+	// Kept from the std::cout printers: log2 always returned false, linear only when empty
+	if (!linear || !shown) {
+		RETURN_FALSE;
+	}
+}
+
+PHP_METHOD (ArrayTable, print_log2_hist) {
+	array_table_render_hist(INTERNAL_FUNCTION_PARAM_PASSTHRU, false, false);
+}
+
+PHP_METHOD (ArrayTable, print_linear_hist) {
+	array_table_render_hist(INTERNAL_FUNCTION_PARAM_PASSTHRU, true, false);
+}
+
+PHP_METHOD (ArrayTable, format_log2_hist) {
+	array_table_render_hist(INTERNAL_FUNCTION_PARAM_PASSTHRU, false, true);
+}
+
+PHP_METHOD (ArrayTable, format_linear_hist) {
+	array_table_render_hist(INTERNAL_FUNCTION_PARAM_PASSTHRU, true, true);
+}
+
+PHP_METHOD (PerCpuArrayTable, sum_value) {
+	int64_t index;
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "l", &index) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
+		RETURN_NULL();
+	}
+
+
+	std::vector<unsigned long> val;
+	try {
+		ebpf::BPFPercpuArrayTable<uint64_t> table(*desc);
+		auto res = table.get_value(index, val);
+		if (res.code() != 0) {
+			zend_throw_error(NULL, "Get value error in %s", name);
+			RETURN_NULL();
+		}
+
+		unsigned long long sum = 0;
+		for (const auto &v: val) {
+			sum += v;
+		}
+
+		RETURN_LONG(sum);
+	} catch (const std::exception &e) {
+		zend_throw_error(NULL, "Exception: %s", e.what());
+		RETURN_NULL();
+	}
+}
+
+enum percpu_op {
+	PERCPU_SUM,
+	PERCPU_MAX,
+	PERCPU_MIN
+};
+
+/* Reduce [entries x ncpus] values to one per entry. Each entry's CPUs are
+   contiguous and the loops are branch-free, so the compiler vectorises them */
+template<typename T>
+static void percpu_reduce(const T *slots, size_t entries, size_t ncpus, percpu_op op, T *out) {
+	for (size_t e = 0; e < entries; e++) {
+		const T *v = slots + e * ncpus;
+		T acc = v[0];
+		switch (op) {
+			case PERCPU_SUM:
+				for (size_t c = 1; c < ncpus; c++)
+					acc += v[c];
+				break;
+			case PERCPU_MAX:
+				for (size_t c = 1; c < ncpus; c++)
+					acc = v[c] > acc ? v[c] : acc;
+				break;
+			case PERCPU_MIN:
+				for (size_t c = 1; c < ncpus; c++)
+					acc = v[c] < acc ? v[c] : acc;
+				break;
+		}
+		out[e] = acc;
+	}
+}
+
+/* Widen the 8-byte aligned per-cpu slots of a dump to a dense T array,
+   reduce it and hand the results back as PHP integers */
+template<typename T>
+static void percpu_reduce_dump(const ebpf::TableDump &dump, size_t leaf_size, percpu_op op,
+                               std::vector<zend_long> &out) {
+	size_t count = dump.values.size() / 8;
+	std::vector<T> slots(count);
+	if (leaf_size == 8) {
+		memcpy(slots.data(), dump.values.data(), count * 8);
+	} else {
+		int shift = 64 - (int) leaf_size * 8;
+		for (size_t i = 0; i < count; i++) {
+			uint64_t v = 0;
+			memcpy(&v, dump.values.data() + i * 8, leaf_size);
+			// Sign-extends for int64_t, a no-op for uint64_t
+			slots[i] = (T) (v << shift) >> shift;
+		}
+	}
+
+	std::vector<T> reduced(dump.count);
+	percpu_reduce(slots.data(), dump.count, dump.value_size / 8, op, reduced.data());
+	out.assign(reduced.begin(), reduced.end());
+}
+
+/* Check that a table holds integer counters; the value type decides signedness */
+static bool table_integer_values(sub_object *obj, const char *name, const ebpf::TableDesc *desc, bool *is_signed) {
+	std::string err;
+	std::unique_ptr<TableSchema> derived;
+	const TableSchema *schema = obj->leaf_schema;
+	if (!schema) {
+		derived.reset(TableSchema::from_desc(desc->leaf_desc, err));
+		schema = derived.get();
+	}
+	if (desc->leaf_size > 8 || (schema && schema->kind() != TableSchema::KIND_INT &&
+	                            schema->kind() != TableSchema::KIND_UINT)) {
+		zend_throw_error(NULL, "Table %s does not hold integer values", name);
+		return false;
+	}
+	*is_signed = schema && schema->kind() == TableSchema::KIND_INT;
+	return true;
+}
+
+/* One integer per entry of a dump: the value itself, or its sum over all
+   CPUs for per-cpu tables */
+static void table_counter_values(const ebpf::TableDump &dump, size_t leaf_size, bool percpu, bool is_signed,
+                                 std::vector<zend_long> &out) {
+	if (percpu) {
+		if (is_signed) {
+			percpu_reduce_dump<int64_t>(dump, leaf_size, PERCPU_SUM, out);
+		} else {
+			percpu_reduce_dump<uint64_t>(dump, leaf_size, PERCPU_SUM, out);
+		}
+		return;
+	}
+
+	int shift = 64 - (int) leaf_size * 8;
+	out.resize(dump.count);
+	for (size_t i = 0; i < dump.count; i++) {
+		uint64_t v = 0;
+		memcpy(&v, dump.value(i), leaf_size);
+		if (is_signed && shift > 0) {
+			v = (uint64_t) (((int64_t) (v << shift)) >> shift);
+		}
+		out[i] = (zend_long) v;
+	}
+}
+
+/* Shared body of sum_all(), max_all() and min_all(): one batched dump of the
+   whole table, then a reduction over all CPUs of every entry */
+static void percpu_table_reduce(INTERNAL_FUNCTION_PARAMETERS, percpu_op op) {
+	zval *options = NULL;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "|a", &options) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	size_t chunk_size;
+	if (!table_dump_options(options, &chunk_size)) {
+		RETURN_NULL();
+	}
+
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
+		RETURN_NULL();
+	}
+
+	ebpf::BPFTable table(*desc);
+	if (!table.is_percpu()) {
+		zend_throw_error(NULL, "Table %s is not a per-cpu table", name);
+		RETURN_NULL();
+	}
+
+	bool is_signed;
+	if (!table_integer_values(obj, name, desc, &is_signed)) {
+		RETURN_NULL();
+	}
+
+	ebpf::TableDump dump;
+	auto status = table.get_table_offline_batch(dump, chunk_size);
+	if (status.code() != 0) {
+		zend_throw_error(NULL, "Failed to get table values: %s", status.msg().c_str());
+		RETURN_NULL();
+	}
+
+	std::vector<zend_long> reduced;
+	if (is_signed) {
+		percpu_reduce_dump<int64_t>(dump, desc->leaf_size, op, reduced);
+	} else {
+		percpu_reduce_dump<uint64_t>(dump, desc->leaf_size, op, reduced);
+	}
+
+	array_init_size(return_value, (uint32_t) dump.count);
+	bool indexed = desc->type == BPF_MAP_TYPE_PERCPU_ARRAY;
+	for (size_t i = 0; i < dump.count; i++) {
+		if (indexed) {
+			uint32_t index = 0;
+			memcpy(&index, dump.key(i), std::min(sizeof(index), dump.key_size));
+			add_index_long(return_value, index, reduced[i]);
+			continue;
+		}
+		zval entry, key;
+		array_init_size(&entry, 2);
+		table_decode(obj->key_schema, dump.key(i), dump.key_size, &key);
+		add_assoc_zval(&entry, "key", &key);
+		add_assoc_long(&entry, "value", reduced[i]);
+		add_next_index_zval(return_value, &entry);
+	}
+}
+
+PHP_METHOD (PerCpuArrayTable, sum_all) {
+	percpu_table_reduce(INTERNAL_FUNCTION_PARAM_PASSTHRU, PERCPU_SUM);
+}
+
+PHP_METHOD (PerCpuArrayTable, max_all) {
+	percpu_table_reduce(INTERNAL_FUNCTION_PARAM_PASSTHRU, PERCPU_MAX);
+}
+
+PHP_METHOD (PerCpuArrayTable, min_all) {
+	percpu_table_reduce(INTERNAL_FUNCTION_PARAM_PASSTHRU, PERCPU_MIN);
+}
+
+PHP_METHOD (HashTable, deltas) {
+	zval *options = NULL;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "|a", &options) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	size_t chunk_size;
+	if (!table_dump_options(options, &chunk_size)) {
+		RETURN_NULL();
+	}
+
+	bool rate = false;
+	zval *tmp;
+	if (options && (tmp = zend_hash_str_find(Z_ARRVAL_P(options), "rate", strlen("rate"))) != NULL) {
+		rate = zend_is_true(tmp);
+	}
+
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
+		RETURN_NULL();
+	}
+
+	bool is_signed;
+	if (!table_integer_values(obj, name, desc, &is_signed)) {
+		RETURN_NULL();
+	}
+
+	ebpf::BPFTable table(*desc);
+	ebpf::TableDump dump;
+	auto status = table.get_table_offline_batch(dump, chunk_size);
+	if (status.code() != 0) {
+		zend_throw_error(NULL, "Failed to get table values: %s", status.msg().c_str());
+		RETURN_NULL();
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	std::vector<zend_long> values;
+	table_counter_values(dump, desc->leaf_size, table.is_percpu(), is_signed, values);
+
+	// Counters start at zero; a rate needs a previous read to measure the interval
+	bool first = obj->snapshot == nullptr;
+	if (first) {
+		obj->snapshot = new table_snapshot();
+	}
+	table_snapshot *snap = obj->snapshot;
+	double elapsed = first ? 0 : (now.tv_sec - snap->taken.tv_sec) + (now.tv_nsec - snap->taken.tv_nsec) / 1e9;
+	bool indexed = desc->type == BPF_MAP_TYPE_ARRAY || desc->type == BPF_MAP_TYPE_PERCPU_ARRAY;
+
+	std::unordered_map<std::string, zend_long> next;
+	next.reserve(dump.count);
+	array_init(return_value);
+	for (size_t i = 0; i < dump.count; i++) {
+		std::string key(dump.key(i), dump.key_size);
+		zend_long cur = values[i];
+		auto it = snap->values.find(key);
+		zend_long prev = it == snap->values.end() ? 0 : it->second;
+		next.emplace(std::move(key), cur);
+
+		// An unsigned counter that went backwards was reset, everything in it is new
+		zend_long delta = !is_signed && (zend_ulong) cur < (zend_ulong) prev ? cur : cur - prev;
+		if (delta == 0 || (rate && elapsed <= 0)) {
+			continue;
+		}
+
+		zval value;
+		if (rate) {
+			ZVAL_DOUBLE(&value, delta / elapsed);
+		} else {
+			ZVAL_LONG(&value, delta);
+		}
+		if (indexed) {
+			uint32_t index = 0;
+			memcpy(&index, dump.key(i), std::min(sizeof(index), dump.key_size));
+			add_index_zval(return_value, index, &value);
+			continue;
+		}
+		zval entry, k;
+		array_init_size(&entry, 2);
+		table_decode(obj->key_schema, dump.key(i), dump.key_size, &k);
+		add_assoc_zval(&entry, "key", &k);
+		add_assoc_zval(&entry, "value", &value);
+		add_next_index_zval(return_value, &entry);
+	}
+
+	snap->values.swap(next);
+	snap->taken = now;
+}
+
+/* Upper bound on the slot index accepted from PHP arrays, far above any BPF array */
+#define HISTOGRAM_MAX_SLOTS (1 << 20)
+
+/* Read slot counts from a PHP array, slot index taken from the integer keys */
+static bool histogram_slots(zval *counts, std::vector<uint64_t> &slots) {
+	zend_ulong index;
+	zend_string *key;
+	zval *val;
+
+	slots.assign(zend_hash_num_elements(Z_ARRVAL_P(counts)), 0);
+	ZEND_HASH_FOREACH_KEY_VAL(Z_ARRVAL_P(counts), index, key, val) {
+		if (key || index >= HISTOGRAM_MAX_SLOTS) {
+			zend_throw_error(NULL, "Histogram slots must be integer keys below %d", HISTOGRAM_MAX_SLOTS);
+			return false;
+		}
+		zend_long count = zval_get_long(val);
+		if (count < 0) {
+			zend_throw_error(NULL, "Histogram slot " ZEND_ULONG_FMT " has a negative count", index);
+			return false;
+		}
+		if (index >= slots.size()) {
+			slots.resize(index + 1, 0);
+		}
+		slots[index] = (uint64_t) count;
+	} ZEND_HASH_FOREACH_END();
+	return true;
+}
+
+static void histogram_return(zval *return_value, Histogram &&hist) {
+	object_init_ex(return_value, histogram_ce);
+	*histogram_fetch_object(Z_OBJ_P(return_value))->hist = std::move(hist);
+}
+
+/* Read the "type" ("log2" or "linear") and "step" histogram options */
+static bool histogram_options(zval *options, bool *linear, zend_long *step) {
+	*linear = false;
+	*step = 1;
+	if (!options || Z_TYPE_P(options) != IS_ARRAY) {
+		return true;
+	}
+
+	zval *tmp;
+	if ((tmp = zend_hash_str_find(Z_ARRVAL_P(options), "type", strlen("type"))) != NULL) {
+		if (Z_TYPE_P(tmp) != IS_STRING ||
+		    (strcmp(Z_STRVAL_P(tmp), "log2") != 0 && strcmp(Z_STRVAL_P(tmp), "linear") != 0)) {
+			zend_throw_error(NULL, "Histogram type must be \"log2\" or \"linear\"");
+			return false;
+		}
+		*linear = strcmp(Z_STRVAL_P(tmp), "linear") == 0;
+	}
+	if ((tmp = zend_hash_str_find(Z_ARRVAL_P(options), "step", strlen("step"))) != NULL) {
+		*step = zval_get_long(tmp);
+		if (*step <= 0) {
+			zend_throw_error(NULL, "step must be positive");
+			return false;
+		}
+	}
+	return true;
+}
+
+static inline Histogram histogram_build(const std::vector<uint64_t> &slots, bool linear, zend_long step) {
+	return linear ? Histogram::linear(slots, (uint64_t) step) : Histogram::log2(slots);
+}
+
+/* Slot counts of one bucket key in a map keyed by {bucket_key, slot} */
+struct histogram_group {
+	std::string key;
+	std::vector<uint64_t> slots;
+};
+
+/* Dump a map keyed by a record with an integer slot field and sum its
+   counters per bucket key, i.e. the key with the slot field zeroed.
+   Groups keep the order in which the dump first met them */
+static bool table_histogram_groups(zval *self, const char *slot_name, size_t chunk_size,
+                                   std::unique_ptr<TableSchema> &derived, const TableSchema **key_schema,
+                                   std::vector<histogram_group> &groups) {
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(self, &name, &desc);
+	if (!obj) {
+		return false;
+	}
+
+	std::string err;
+	*key_schema = obj->key_schema;
+	if (!*key_schema) {
+		derived.reset(TableSchema::from_desc(desc->key_desc, err));
+		*key_schema = derived.get();
+	}
+	const TableSchema::Field *slot = *key_schema ? (*key_schema)->int_field(slot_name) : nullptr;
+	if (!slot) {
+		zend_throw_error(NULL, "Key of table %s has no integer field \"%s\"", name, slot_name);
+		return false;
+	}
+
+	bool is_signed;
+	if (!table_integer_values(obj, name, desc, &is_signed)) {
+		return false;
+	}
+
+	ebpf::BPFTable table(*desc);
+	ebpf::TableDump dump;
+	auto status = table.get_table_offline_batch(dump, chunk_size);
+	if (status.code() != 0) {
+		zend_throw_error(NULL, "Failed to get table values: %s", status.msg().c_str());
+		return false;
+	}
+
+	std::vector<zend_long> values;
+	table_counter_values(dump, desc->leaf_size, table.is_percpu(), is_signed, values);
+
+	std::unordered_map<std::string, size_t> index;
+	size_t slot_size = slot->type->size;
+	for (size_t i = 0; i < dump.count; i++) {
+		std::string key(dump.key(i), dump.key_size);
+		uint64_t n = 0;
+		memcpy(&n, &key[slot->offset], slot_size);
+		memset(&key[slot->offset], 0, slot_size);
+		if (n >= HISTOGRAM_MAX_SLOTS) {
+			zend_throw_error(NULL, "Slot %llu of table %s is out of range", (unsigned long long) n, name);
+			return false;
+		}
+
+		auto it = index.find(key);
+		if (it == index.end()) {
+			it = index.emplace(key, groups.size()).first;
+			groups.push_back({std::move(key), {}});
+		}
+		std::vector<uint64_t> &slots = groups[it->second].slots;
+		if (n >= slots.size()) {
+			slots.resize(n + 1, 0);
+		}
+		slots[n] += values[i] < 0 ? 0 : (uint64_t) values[i];
+	}
+	return true;
+}
+
+/* Decode a bucket key without its slot field */
+static void histogram_group_key(const TableSchema *key_schema, const histogram_group &group, const char *slot_name,
+                                zval *out) {
+	key_schema->decode(group.key.data(), group.key.size(), out);
+	if (Z_TYPE_P(out) == IS_ARRAY) {
+		zend_hash_str_del(Z_ARRVAL_P(out), slot_name, strlen(slot_name));
+	}
+}
+
+/* Section label of a bucket key: the lone remaining field, or "name=value, ..." */
+static std::string histogram_group_label(zval *key) {
+	if (Z_TYPE_P(key) != IS_ARRAY) {
+		zend_string *str = zval_get_string(key);
+		std::string label(ZSTR_VAL(str), ZSTR_LEN(str));
+		zend_string_release(str);
+		return label;
+	}
+
+	bool single = zend_hash_num_elements(Z_ARRVAL_P(key)) == 1;
+	std::string label;
+	zend_string *field;
+	zval *val;
+	ZEND_HASH_FOREACH_STR_KEY_VAL(Z_ARRVAL_P(key), field, val) {
+		if (!label.empty()) {
+			label += ", ";
+		}
+		if (!single && field) {
+			label.append(ZSTR_VAL(field), ZSTR_LEN(field));
+			label += '=';
+		}
+		label += histogram_group_label(val);
+	} ZEND_HASH_FOREACH_END();
+	return label;
+}
+
+/* Read the "slot" option naming the slot field of a {bucket_key, slot} key */
+static bool histogram_slot_option(zval *options, const char **slot_name) {
+	*slot_name = "slot";
+	zval *tmp;
+	if (options && (tmp = zend_hash_str_find(Z_ARRVAL_P(options), "slot", strlen("slot"))) != NULL) {
+		if (Z_TYPE_P(tmp) != IS_STRING) {
+			zend_throw_error(NULL, "slot must be a field name");
+			return false;
+		}
+		*slot_name = Z_STRVAL_P(tmp);
+	}
+	return true;
+}
+
+PHP_METHOD (HashTable, histograms) {
+	zval *options = NULL;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "|a", &options) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	size_t chunk_size;
+	bool linear;
+	zend_long step;
+	const char *slot_name;
+	if (!table_dump_options(options, &chunk_size) || !histogram_options(options, &linear, &step) ||
+	    !histogram_slot_option(options, &slot_name)) {
+		RETURN_NULL();
+	}
+
+	std::unique_ptr<TableSchema> derived;
+	const TableSchema *key_schema;
+	std::vector<histogram_group> groups;
+	if (!table_histogram_groups(getThis(), slot_name, chunk_size, derived, &key_schema, groups)) {
+		RETURN_NULL();
+	}
+
+	array_init_size(return_value, (uint32_t) groups.size());
+	for (const auto &group: groups) {
+		zval entry, key, hist;
+		array_init_size(&entry, 2);
+		histogram_group_key(key_schema, group, slot_name, &key);
+		histogram_return(&hist, histogram_build(group.slots, linear, step));
+		add_assoc_zval(&entry, "key", &key);
+		add_assoc_zval(&entry, "histogram", &hist);
+		add_next_index_zval(return_value, &entry);
+	}
+}
+
+/* Shared body of HashTable::print_*_hist() and format_*_hist(): one
+   histogram per bucket key, each under a "section_header = key" line,
+   all rendered into one buffer. print_* takes the target stream from the
+   "stream" option */
+static void table_render_histograms(INTERNAL_FUNCTION_PARAMETERS, bool linear, bool to_string) {
+	char *header;
+	size_t header_len;
+	char *section = (char *) "Bucket";
+	size_t section_len = strlen("Bucket");
+	zval *options = NULL;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "s|sa", &header, &header_len, &section, &section_len,
+	                          &options) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	size_t chunk_size;
+	const char *slot_name;
+	if (!table_dump_options(options, &chunk_size) || !histogram_slot_option(options, &slot_name)) {
+		RETURN_NULL();
+	}
+
+	std::unique_ptr<TableSchema> derived;
+	const TableSchema *key_schema;
+	std::vector<histogram_group> groups;
+	if (!table_histogram_groups(getThis(), slot_name, chunk_size, derived, &key_schema, groups)) {
+		RETURN_NULL();
+	}
+
+	std::string text;
+	std::string head(header, header_len);
+	for (const auto &group: groups) {
+		zval key;
+		histogram_group_key(key_schema, group, slot_name, &key);
+		text += '\n';
+		text.append(section, section_len);
+		text += " = ";
+		text += histogram_group_label(&key);
+		text += '\n';
+		zval_ptr_dtor(&key);
+		if (linear) {
+			histogram_render_linear(group.slots, head, text);
+		} else {
+			histogram_render_log2(group.slots, head, text);
+		}
+	}
+
+	if (to_string) {
+		RETURN_STRINGL(text.data(), text.size());
+	}
+	if (!histogram_output(histogram_stream_option(options), text)) {
+		RETURN_NULL();
+	}
+}
+
+PHP_METHOD (HashTable, print_log2_hist) {
+	table_render_histograms(INTERNAL_FUNCTION_PARAM_PASSTHRU, false, false);
+}
+
+PHP_METHOD (HashTable, print_linear_hist) {
+	table_render_histograms(INTERNAL_FUNCTION_PARAM_PASSTHRU, true, false);
+}
+
+PHP_METHOD (HashTable, format_log2_hist) {
+	table_render_histograms(INTERNAL_FUNCTION_PARAM_PASSTHRU, false, true);
+}
+
+PHP_METHOD (HashTable, format_linear_hist) {
+	table_render_histograms(INTERNAL_FUNCTION_PARAM_PASSTHRU, true, true);
+}
+
+PHP_METHOD (ArrayTable, histogram) {
+	zval *options = NULL;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "|a", &options) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	size_t chunk_size;
+	if (!table_dump_options(options, &chunk_size)) {
+		RETURN_NULL();
+	}
+
+	bool linear;
+	zend_long step;
+	if (!histogram_options(options, &linear, &step)) {
+		RETURN_NULL();
+	}
+
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
+		RETURN_NULL();
+	}
+
+	bool is_signed;
+	if (!table_integer_values(obj, name, desc, &is_signed)) {
+		RETURN_NULL();
+	}
+
+	ebpf::BPFTable table(*desc);
+	ebpf::TableDump dump;
+	auto status = table.get_table_offline_batch(dump, chunk_size);
+	if (status.code() != 0) {
+		zend_throw_error(NULL, "Failed to get table values: %s", status.msg().c_str());
+		RETURN_NULL();
+	}
+
+	// Per-cpu slots are summed over all CPUs before bucketing
+	std::vector<zend_long> values;
+	table_counter_values(dump, desc->leaf_size, table.is_percpu(), is_signed, values);
+
+	std::vector<uint64_t> slots(dump.count, 0);
+	for (size_t i = 0; i < dump.count; i++) {
+		uint32_t index = 0;
+		memcpy(&index, dump.key(i), std::min(sizeof(index), dump.key_size));
+		if (index >= slots.size()) {
+			slots.resize(index + 1, 0);
+		}
+		slots[index] = values[i] < 0 ? 0 : (uint64_t) values[i];
+	}
+
+	histogram_return(return_value, histogram_build(slots, linear, step));
+}
+
+PHP_METHOD (Histogram, log2) {
+	zval *counts;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "a", &counts) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	std::vector<uint64_t> slots;
+	if (!histogram_slots(counts, slots)) {
+		RETURN_NULL();
+	}
+	histogram_return(return_value, Histogram::log2(slots));
+}
+
+PHP_METHOD (Histogram, linear) {
+	zval *counts;
+	zend_long step = 1;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "a|l", &counts, &step) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	if (step <= 0) {
+		zend_throw_error(NULL, "step must be positive");
+		RETURN_NULL();
+	}
+
+	std::vector<uint64_t> slots;
+	if (!histogram_slots(counts, slots)) {
+		RETURN_NULL();
+	}
+	histogram_return(return_value, Histogram::linear(slots, (uint64_t) step));
+}
+
+PHP_METHOD (Histogram, buckets) {
+	if (zend_parse_parameters_none() == FAILURE) {
+		RETURN_NULL();
+	}
+
+	const Histogram *hist = histogram_fetch_object(Z_OBJ_P(getThis()))->hist;
+	array_init_size(return_value, (uint32_t) hist->buckets().size());
+	for (const auto &b: hist->buckets()) {
+		zval bucket;
+		array_init_size(&bucket, 3);
+		add_assoc_long(&bucket, "low", (zend_long) b.low);
+		add_assoc_long(&bucket, "high", (zend_long) b.high);
+		add_assoc_long(&bucket, "count", (zend_long) b.count);
+		add_next_index_zval(return_value, &bucket);
+	}
+}
+
+PHP_METHOD (Histogram, total) {
+	if (zend_parse_parameters_none() == FAILURE) {
+		RETURN_NULL();
+	}
+
+	RETURN_LONG((zend_long) histogram_fetch_object(Z_OBJ_P(getThis()))->hist->total());
+}
+
+PHP_METHOD (Histogram, percentile) {
+	double p;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "d", &p) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	if (p < 0 || p > 100) {
+		zend_throw_error(NULL, "Percentile must be between 0 and 100");
+		RETURN_NULL();
+	}
+
+	const Histogram *hist = histogram_fetch_object(Z_OBJ_P(getThis()))->hist;
+	if (hist->total() == 0) {
+		RETURN_NULL();
+	}
+	RETURN_DOUBLE(hist->percentile(p));
+}
+
+PHP_METHOD (Histogram, percentiles) {
+	zval *ps = NULL;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "|a", &ps) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	std::vector<double> wanted;
+	if (ps) {
+		zval *p;
+		ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(ps), p) {
+			double v = zval_get_double(p);
+			if (v < 0 || v > 100) {
+				zend_throw_error(NULL, "Percentile must be between 0 and 100");
+				RETURN_NULL();
+			}
+			wanted.push_back(v);
+		} ZEND_HASH_FOREACH_END();
+	} else {
+		wanted = {50, 90, 99, 99.9};
+	}
+
+	const Histogram *hist = histogram_fetch_object(Z_OBJ_P(getThis()))->hist;
+	bool empty = hist->total() == 0;
+
+	// Keys keep the decimal point, so 99.9 => "p99.9" and 9.99 => "p9.99" stay apart
+	array_init_size(return_value, (uint32_t) wanted.size());
+	for (double p: wanted) {
+		char key[64];
+		snprintf(key, sizeof(key), "p%.15g", p);
+		if (empty) {
+			add_assoc_null(return_value, key);
+		} else {
+			add_assoc_double(return_value, key, hist->percentile(p));
+		}
+	}
+}
+
+PHP_METHOD (Histogram, merge) {
+	zval *others = NULL;
+	int count = 0;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "*", &others, &count) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	Histogram merged = *histogram_fetch_object(Z_OBJ_P(getThis()))->hist;
+	std::string err;
+	for (int i = 0; i < count; i++) {
+		if (Z_TYPE(others[i]) != IS_OBJECT || !instanceof_function(Z_OBJCE(others[i]), histogram_ce)) {
+			zend_throw_error(NULL, "Argument #%d is not a Histogram", i + 1);
+			RETURN_NULL();
+		}
+		if (!merged.merge(*histogram_fetch_object(Z_OBJ(others[i]))->hist, err)) {
+			zend_throw_error(NULL, "Cannot merge histograms: %s", err.c_str());
+			RETURN_NULL();
+		}
+	}
+	histogram_return(return_value, std::move(merged));
+}
+
+/* Stacks added from PHP, e.g. joined from tables read with values(), and
+   written the same way as StackTraceTable::export_profile() writes them */
+PHP_METHOD (Profile, add) {
+	zval *frames_zv;
+	zend_long value;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "al", &frames_zv, &value) == FAILURE) {
+		RETURN_NULL();
+	}
+
+	std::vector<std::string> names;
+	zval *frame;
+	ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(frames_zv), frame) {
+		if (Z_TYPE_P(frame) != IS_STRING) {
+			zend_throw_error(NULL, "Frames must be strings");
+			RETURN_NULL();
+		}
+		names.emplace_back(Z_STRVAL_P(frame), Z_STRLEN_P(frame));
+	} ZEND_HASH_FOREACH_END();
+	if (names.empty()) {
+		zend_throw_error(NULL, "A stack needs at least one frame");
+		RETURN_NULL();
+	}
+
+	std::vector<const std::string *> frames;
+	frames.reserve(names.size());
+	for (const auto &name: names) {
+		frames.push_back(&name);
+	}
+	profile_fetch_object(Z_OBJ_P(getThis()))->profile->add(frames, (int64_t) value);
+}
+
+PHP_METHOD (Profile, size) {
+	if (zend_parse_parameters_none() == FAILURE) {
+		RETURN_NULL();
+	}
+
+	RETURN_LONG((zend_long) profile_fetch_object(Z_OBJ_P(getThis()))->profile->size());
+}
+
+PHP_METHOD (Profile, folded) {
+	if (zend_parse_parameters_none() == FAILURE) {
 		RETURN_NULL();
 	}
+
+	std::string out;
+	profile_fetch_object(Z_OBJ_P(getThis()))->profile->write_folded([&out](const char *data, size_t len) {
+		out.append(data, len);
+		return true;
+	});
+	RETURN_STRINGL(out.data(), out.size());
 }
 
-PHP_METHOD (ArrayTable, print_log2_hist) {
-	char *header;
-	size_t header_len;
-	if (zend_parse_parameters(ZEND_NUM_ARGS(), "s", &header, &header_len) == FAILURE) {
+PHP_METHOD (Profile, pprof) {
+	char *sample_type = (char *) "samples", *unit = (char *) "count";
+	size_t sample_type_len = strlen(sample_type), unit_len = strlen(unit);
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "|ss", &sample_type, &sample_type_len, &unit, &unit_len) == FAILURE) {
 		RETURN_NULL();
 	}
 
-	zval *name_zv = sc_zend_read_property(Z_OBJCE_P(getThis()), getThis(), "name",
-	                                      sizeof("name") - 1, 0);
+	std::string out;
+	profile_fetch_object(Z_OBJ_P(getThis()))->profile->write_pprof([&out](const char *data, size_t len) {
+		out.append(data, len);
+		return true;
+	}, std::string(sample_type, sample_type_len), std::string(unit, unit_len));
+	RETURN_STRINGL(out.data(), out.size());
+}
 
+PHP_METHOD (StackTraceTable, values) {
+	zend_long stack_id;
+	zend_long pid = -1;
 
-	if (!name_zv || Z_TYPE_P(name_zv) != IS_STRING) {
-		zend_throw_error(NULL, "Invalid or missing name property");
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "l|l", &stack_id, &pid) == FAILURE) {
 		RETURN_NULL();
 	}
 
-	sub_object *obj = table_fetch_object(Z_OBJ_P(getThis()));
-	if (!obj || !obj->bpf) {
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
+		RETURN_NULL();
+	}
+	if (!obj->ext) {
 		zend_throw_error(NULL, "Invalid object state");
 		RETURN_NULL();
 	}
 
-	auto table = obj->bpf->get_array_table<uint64_t>(Z_STRVAL_P(name_zv));
+	// Symbols come from the caches of the Bpf object, not from the table
+	// wrapper, so they survive across calls
+	auto table = obj->bpf->get_stack_table(name);
+	auto symbols = obj->ext->resolve_stack(table.get_stack_addr((int) stack_id), (int) pid);
 
-	auto vals = table.get_table_offline();
-	auto center_text = [](const std::string &text, int width) -> std::string {
-		int len = static_cast<int>(text.length());
-		if (width <= len) return text;
-		int padding = width - len;
-		int left = padding / 2;
-		int right = padding - left;
-		return std::string(left, ' ') + text + std::string(right, ' ');
-	};
-	auto stars = [](uint64_t val, uint64_t max_val, int width) -> std::string {
-		std::string result;
-		int limit = std::min(width, static_cast<int>((double) val * width / max_val));
-		for (int i = 0; i < limit; ++i) {
-			result += '*';
-		}
-		if (val > max_val && !result.empty()) {
-			result.back() = '+';
-		}
-		return result;
-	};
+	array_init(return_value);
 
-	int idx_max = -1;
-	uint64_t val_max = 0;
+	for (const auto &str: symbols) {
+		add_next_index_string(return_value, str.c_str());
+	}
+}
 
-	for (size_t i = 0; i < vals.size(); ++i) {
-		if (vals[i] > 0) {
-			idx_max = static_cast<int>(i);
-			if (vals[i] > val_max) val_max = vals[i];
+/* Stacks read from a StackTraceTable, with every distinct instruction
+   pointer resolved once however many stacks share it */
+struct resolved_stacks {
+	std::vector<std::vector<uintptr_t>> addrs;
+	std::unordered_map<uintptr_t, std::string> names;
+};
+
+/* Look up the given stacks and resolve their addresses in one pass over
+   the unique ones. Unknown stack ids give empty stacks */
+static void stack_table_resolve(EbpfExtension *ext, ebpf::BPFStackTable &table, const std::vector<int> &ids,
+                                int pid, resolved_stacks &out) {
+	out.addrs.resize(ids.size());
+	std::vector<uintptr_t> unique;
+	for (size_t i = 0; i < ids.size(); i++) {
+		out.addrs[i] = table.get_stack_addr(ids[i]);
+		for (auto addr: out.addrs[i]) {
+			if (out.names.emplace(addr, std::string()).second) {
+				unique.push_back(addr);
+			}
 		}
 	}
 
-	if (idx_max == -1) {
-		std::cout << "No data to display." << std::endl;
-		RETURN_FALSE;
+	auto symbols = ext->resolve_stack(unique, pid);
+	for (size_t i = 0; i < unique.size(); i++) {
+		out.names[unique[i]].swap(symbols[i]);
 	}
+}
 
-	int stars_max = 40;
-	bool long_format = idx_max > 32;
-
-	int col1_width = long_format ? 41 : 27;
-	int label_width = col1_width - 2;
-
-	std::cout << center_text(header, label_width) << ": count    distribution" << std::endl;
-
-	bool strip_leading_zero = true;
-	for (int i = 1; i <= idx_max; ++i) {
-		uint64_t low = (1ULL << (i - 1));
-		uint64_t high = (1ULL << i) - 1;
-		if (low == high) low -= 1;
-
-		uint64_t val = vals[i];
-		if (strip_leading_zero && val == 0) {
-			continue;
-		}
-		strip_leading_zero = false;
-
-		std::string bar = stars(val, val_max, stars_max);
-		if (long_format) {
-			std::cout << std::right << std::setw(20) << low << " -> "
-			          << std::left << std::setw(20) << high << " : "
-			          << std::setw(8) << val << "|" << bar << "|" << std::endl;
-		} else {
-			std::cout << std::right << std::setw(10) << low << " -> "
-			          << std::left << std::setw(10) << high << " : "
-			          << std::setw(8) << val << "|" << bar << "|" << std::endl;
+/* Append one stack in flamegraph.pl's folded form, outermost frame first */
+static void stack_fold(const resolved_stacks &stacks, size_t i, std::string &out) {
+	const auto &addrs = stacks.addrs[i];
+	for (size_t f = addrs.size(); f-- > 0;) {
+		out += stacks.names.at(addrs[f]);
+		if (f > 0) {
+			out += ';';
 		}
 	}
-
-	RETURN_FALSE;
 }
 
-PHP_METHOD (ArrayTable, print_linear_hist) {
-	char *header;
-	size_t header_len;
+PHP_METHOD (StackTraceTable, values_many) {
+	zval *ids_zv;
+	zend_long pid = -1;
+	zval *options = NULL;
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS(), "s", &header, &header_len) == FAILURE) {
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "a|la", &ids_zv, &pid, &options) == FAILURE) {
 		RETURN_NULL();
 	}
-	zval *name_zv = sc_zend_read_property(Z_OBJCE_P(getThis()), getThis(), "name",
-	                                      sizeof("name") - 1, 0);
 
-	if (!name_zv || Z_TYPE_P(name_zv) != IS_STRING) {
-		zend_throw_error(NULL, "Invalid or missing name property");
-		RETURN_NULL();
+	bool folded = false;
+	zval *tmp;
+	if (options && (tmp = zend_hash_str_find(Z_ARRVAL_P(options), "folded", strlen("folded"))) != NULL) {
+		folded = zend_is_true(tmp);
 	}
 
-	sub_object *obj = table_fetch_object(Z_OBJ_P(getThis()));
-	if (!obj || !obj->bpf) {
-		zend_throw_error(NULL, "Invalid object state");
+	const char *name;
+	const ebpf::TableDesc *desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
 		RETURN_NULL();
 	}
-
-	auto table = obj->bpf->get_array_table<uint64_t>(Z_STRVAL_P(name_zv));
-	auto res = table.get_table_offline();
-
-	if (res.empty()) {
-		std::cout << "empty histogram" << std::endl;
-		RETURN_FALSE;
+	if (!obj->ext) {
+		zend_throw_error(NULL, "Invalid object state");
+		RETURN_NULL();
 	}
 
-	uint64_t max_val = *std::max_element(res.begin(), res.end());
-	if (max_val == 0) max_val = 1;
-	std::cout << "    " << std::left << std::setw(12) << header
-	          << std::setw(10) << ": count"
-	          << " distribution\n";
-
+	std::vector<int> ids;
+	ids.reserve(zend_hash_num_elements(Z_ARRVAL_P(ids_zv)));
+	zval *id;
+	ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(ids_zv), id) {
+		ids.push_back((int) zval_get_long(id));
+	} ZEND_HASH_FOREACH_END();
 
-	int stars_max = 40;
-	for (size_t i = 0; i < res.size(); ++i) {
-		if (res[i] == 0) continue;
+	auto table = obj->bpf->get_stack_table(name);
+	resolved_stacks stacks;
+	stack_table_resolve(obj->ext, table, ids, (int) pid, stacks);
 
-		std::string bar;
-		int limit = std::min(stars_max, static_cast<int>((double) res[i] * stars_max / max_val));
-		for (int j = 0; j < limit; ++j) bar += '*';
-		if (res[i] > max_val && !bar.empty()) bar.back() = '+';
+	// Keyed by stack id, so repeated ids collapse to one entry
+	array_init_size(return_value, (uint32_t) ids.size());
+	std::string line;
+	for (size_t i = 0; i < ids.size(); i++) {
+		if (folded) {
+			line.clear();
+			stack_fold(stacks, i, line);
+			add_index_stringl(return_value, ids[i], line.data(), line.size());
+			continue;
+		}
+		zval frames;
+		array_init_size(&frames, (uint32_t) stacks.addrs[i].size());
+		for (auto addr: stacks.addrs[i]) {
+			const std::string &sym = stacks.names.at(addr);
+			add_next_index_stringl(&frames, sym.data(), sym.size());
+		}
+		add_index_zval(return_value, ids[i], &frames);
+	}
+}
 
-		std::string count_str = ": " + std::to_string(res[i]);
-		std::cout << "    " << std::left << std::setw(12) << i
-		          << std::setw(10) << count_str
-		          << "|" << bar << "|\n";
+/* Read an optional field name option of export_profile() */
+static bool profile_field_option(zval *options, const char *opt, const char *def, const char **field) {
+	*field = def;
+	zval *tmp;
+	if (options && (tmp = zend_hash_str_find(Z_ARRVAL_P(options), opt, strlen(opt))) != NULL) {
+		if (Z_TYPE_P(tmp) != IS_STRING) {
+			zend_throw_error(NULL, "%s must be a field name", opt);
+			return false;
+		}
+		*field = Z_STRVAL_P(tmp);
 	}
+	return true;
 }
 
-PHP_METHOD (PerCpuArrayTable, sum_value) {
-	int64_t index;
-	if (zend_parse_parameters(ZEND_NUM_ARGS(), "l", &index) == FAILURE) {
-		RETURN_NULL();
+/* Integer read from a key at the given field, sign-extended for signed fields */
+static int64_t profile_key_int(const char *key, const TableSchema::Field *field) {
+	uint64_t v = 0;
+	size_t size = field->type->size;
+	memcpy(&v, key + field->offset, size);
+	if (field->type->kind == TableSchema::KIND_INT && size < 8) {
+		int shift = 64 - (int) size * 8;
+		v = (uint64_t) (((int64_t) (v << shift)) >> shift);
 	}
+	return (int64_t) v;
+}
 
-	zval *name_zv = sc_zend_read_property(Z_OBJCE_P(getThis()), getThis(), "name",
-	                                      sizeof("name") - 1, 0);
+/* Stack ids of one counts entry: -1 where the key has no such stack */
+struct profile_entry {
+	int user_id;
+	int kernel_id;
+	int pid;
+	int64_t value;
+};
 
+PHP_METHOD (StackTraceTable, export_profile) {
+	zval *counts_zv;
+	char *path;
+	size_t path_len;
+	zval *options = NULL;
 
-	if (!name_zv || Z_TYPE_P(name_zv) != IS_STRING) {
-		zend_throw_error(NULL, "Invalid or missing name property");
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "os|a", &counts_zv, &path, &path_len, &options) == FAILURE) {
 		RETURN_NULL();
 	}
 
-	sub_object *obj = table_fetch_object(Z_OBJ_P(getThis()));
+	bool pprof = false;
+	zend_long fixed_pid = -1;
+	std::string sample_type = "samples", unit = "count";
+	zval *tmp;
+	if (options && (tmp = zend_hash_str_find(Z_ARRVAL_P(options), "format", strlen("format"))) != NULL) {
+		if (Z_TYPE_P(tmp) != IS_STRING ||
+		    (strcmp(Z_STRVAL_P(tmp), "folded") != 0 && strcmp(Z_STRVAL_P(tmp), "pprof") != 0)) {
+			zend_throw_error(NULL, "Profile format must be \"folded\" or \"pprof\"");
+			RETURN_NULL();
+		}
+		pprof = strcmp(Z_STRVAL_P(tmp), "pprof") == 0;
+	}
+	if (options && (tmp = zend_hash_str_find(Z_ARRVAL_P(options), "pid", strlen("pid"))) != NULL) {
+		fixed_pid = zval_get_long(tmp);
+	}
+	if (options && (tmp = zend_hash_str_find(Z_ARRVAL_P(options), "sample_type", strlen("sample_type"))) != NULL) {
+		zend_string *str = zval_get_string(tmp);
+		sample_type.assign(ZSTR_VAL(str), ZSTR_LEN(str));
+		zend_string_release(str);
+	}
+	if (options && (tmp = zend_hash_str_find(Z_ARRVAL_P(options), "unit", strlen("unit"))) != NULL) {
+		zend_string *str = zval_get_string(tmp);
+		unit.assign(ZSTR_VAL(str), ZSTR_LEN(str));
+		zend_string_release(str);
+	}
 
-	if (!obj || !obj->bpf) {
+	size_t chunk_size;
+	const char *user_field, *kernel_field, *pid_field;
+	if (!table_dump_options(options, &chunk_size) ||
+	    !profile_field_option(options, "stack_id", "stack_id", &user_field) ||
+	    !profile_field_option(options, "kernel_stack_id", "kernel_stack_id", &kernel_field) ||
+	    !profile_field_option(options, "pid_field", "pid", &pid_field)) {
+		RETURN_NULL();
+	}
+
+	const char *name, *counts_name;
+	const ebpf::TableDesc *desc, *counts_desc;
+	sub_object *obj = table_this(getThis(), &name, &desc);
+	if (!obj) {
+		RETURN_NULL();
+	}
+	if (!obj->ext) {
 		zend_throw_error(NULL, "Invalid object state");
 		RETURN_NULL();
 	}
+	if (!instanceof_function(Z_OBJCE_P(counts_zv), hash_table_ce) &&
+	    !instanceof_function(Z_OBJCE_P(counts_zv), lru_hash_table_ce) &&
+	    !instanceof_function(Z_OBJCE_P(counts_zv), per_cpu_hash_table_ce) &&
+	    !instanceof_function(Z_OBJCE_P(counts_zv), lru_per_cpu_hash_table_ce)) {
+		zend_throw_error(NULL, "Counts must be a hash table");
+		RETURN_NULL();
+	}
+	sub_object *counts = table_this(counts_zv, &counts_name, &counts_desc);
+	if (!counts) {
+		RETURN_NULL();
+	}
 
+	bool is_signed;
+	if (!table_integer_values(counts, counts_name, counts_desc, &is_signed)) {
+		RETURN_NULL();
+	}
 
-	std::vector<unsigned long> val;
-	try {
-		auto table = obj->bpf->get_percpu_array_table<uint64_t>(Z_STRVAL_P(name_zv));
-		auto res = table.get_value(index, val);
-		if (res.code() != 0) {
-			zend_throw_error(NULL, "Get value error in %s", Z_STRVAL_P(name_zv));
+	// The key is either the stack id itself or a record naming its fields
+	std::string err;
+	std::unique_ptr<TableSchema> derived;
+	const TableSchema *key_schema = counts->key_schema;
+	if (!key_schema) {
+		derived.reset(TableSchema::from_desc(counts_desc->key_desc, err));
+		key_schema = derived.get();
+	}
+	const TableSchema::Field *user_f = nullptr, *kernel_f = nullptr, *pid_f = nullptr;
+	if (key_schema && key_schema->kind() == TableSchema::KIND_RECORD) {
+		user_f = key_schema->int_field(user_field);
+		kernel_f = key_schema->int_field(kernel_field);
+		pid_f = key_schema->int_field(pid_field);
+		if (!user_f && !kernel_f) {
+			zend_throw_error(NULL, "Key of table %s has no \"%s\" or \"%s\" field", counts_name, user_field,
+			                 kernel_field);
 			RETURN_NULL();
 		}
+	} else if (counts_desc->key_size > 8) {
+		zend_throw_error(NULL, "Key of table %s is not a stack id", counts_name);
+		RETURN_NULL();
+	}
 
-		unsigned long long sum = 0;
-		for (const auto &v: val) {
-			sum += v;
-		}
-
-		RETURN_LONG(sum);
-	} catch (const std::exception &e) {
-		zend_throw_error(NULL, "Exception: %s", e.what());
+	auto counts_table = counts->bpf->get_table(counts_name);
+	ebpf::TableDump dump;
+	auto status = counts_table.get_table_offline_batch(dump, chunk_size);
+	if (status.code() != 0) {
+		zend_throw_error(NULL, "Failed to get table values: %s", status.msg().c_str());
 		RETURN_NULL();
 	}
-}
 
-PHP_METHOD (StackTraceTable, values) {
-	zend_long stack_id;
-	zend_long pid = -1;
+	std::vector<zend_long> values;
+	table_counter_values(dump, counts_desc->leaf_size, counts_table.is_percpu(), is_signed, values);
+
+	// Distinct stack ids per symbolization pid, kernel stacks under -1
+	std::vector<profile_entry> entries(dump.count);
+	std::map<int, std::vector<int>> wanted;
+	std::map<int, std::unordered_map<int, size_t>> slot;
+	auto want = [&](int pid, int id) {
+		auto &ids = slot[pid];
+		if (ids.emplace(id, wanted[pid].size()).second) {
+			wanted[pid].push_back(id);
+		}
+	};
+	for (size_t i = 0; i < dump.count; i++) {
+		profile_entry &e = entries[i];
+		const char *key = dump.key(i);
+		if (user_f || kernel_f) {
+			e.user_id = user_f ? (int) profile_key_int(key, user_f) : -1;
+			e.kernel_id = kernel_f ? (int) profile_key_int(key, kernel_f) : -1;
+			e.pid = pid_f ? (int) profile_key_int(key, pid_f) : (int) fixed_pid;
+		} else {
+			int64_t id = 0;
+			memcpy(&id, key, dump.key_size);
+			e.user_id = (int) id;
+			e.kernel_id = -1;
+			e.pid = (int) fixed_pid;
+		}
+		e.pid = e.pid < 0 ? -1 : e.pid;
+		e.value = values[i];
+		if (e.user_id >= 0) {
+			want(e.pid, e.user_id);
+		}
+		if (e.kernel_id >= 0) {
+			want(-1, e.kernel_id);
+		}
+	}
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS(), "l|l", &stack_id, &pid) == FAILURE) {
-		RETURN_NULL();
+	auto table = obj->bpf->get_stack_table(name);
+	std::map<int, resolved_stacks> resolved;
+	for (const auto &group: wanted) {
+		stack_table_resolve(obj->ext, table, group.second, group.first, resolved[group.first]);
 	}
 
-	zval *name_zv = sc_zend_read_property(Z_OBJCE_P(getThis()), getThis(), "name",
-	                                      sizeof("name") - 1, 0);
+	// Kernel frames are the innermost ones, the user stack continues below them
+	ProfileBuilder profile;
+	std::vector<const std::string *> frames;
+	auto append = [&](int pid, int id) {
+		if (id < 0) {
+			return;
+		}
+		const resolved_stacks &stacks = resolved[pid];
+		for (auto addr: stacks.addrs[slot[pid][id]]) {
+			frames.push_back(&stacks.names.at(addr));
+		}
+	};
+	for (const auto &e: entries) {
+		frames.clear();
+		append(-1, e.kernel_id);
+		append(e.pid, e.user_id);
+		if (!frames.empty()) {
+			profile.add(frames, e.value);
+		}
+	}
 
-	if (!name_zv || Z_TYPE_P(name_zv) != IS_STRING) {
-		zend_throw_error(NULL, "Invalid or missing name property");
+	php_stream *stream = php_stream_open_wrapper(path, "wb", REPORT_ERRORS, NULL);
+	if (!stream) {
+		zend_throw_error(NULL, "Cannot open %s for writing", path);
 		RETURN_NULL();
 	}
-
-	sub_object *obj = table_fetch_object(Z_OBJ_P(getThis()));
-	if (!obj || !obj->bpf) {
-		zend_throw_error(NULL, "Invalid object state");
+	auto sink = [stream](const char *data, size_t len) {
+		return (size_t) php_stream_write(stream, data, len) == len;
+	};
+	bool ok = pprof ? profile.write_pprof(sink, sample_type, unit) : profile.write_folded(sink);
+	php_stream_close(stream);
+	if (!ok) {
+		zend_throw_error(NULL, "Failed to write profile to %s", path);
 		RETURN_NULL();
 	}
 
-	auto table = obj->bpf->get_stack_table(Z_STRVAL_P(name_zv));
-	auto symbols = table.get_stack_symbol((int) stack_id, (int) pid);
-
-	array_init(return_value);
-
-	for (const auto &str: symbols) {
-		add_next_index_string(return_value, str.c_str());
-	}
+	RETURN_LONG((zend_long) profile.size());
 }
 
 
@@ -1577,6 +4229,12 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_bpf_get, 0, 0, 1)
     ZEND_ARG_INFO(0, name)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_bpf_from_cache, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+#define arginfo_bpf_free_bcc_memory arginfo_bpf_from_cache
+#define arginfo_bpf_bcc_memory_reclaimed arginfo_bpf_from_cache
+
 ZEND_BEGIN_ARG_INFO_EX(arginfo_bpf_get_kprobe_functions, 0, 0, 1)
     ZEND_ARG_INFO(0, fn)
 ZEND_END_ARG_INFO()
@@ -1630,12 +4288,26 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_bpf_get_table, 0, 0, 1)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_bpf_perf_buffer_poll, 0, 0, 0)
+    ZEND_ARG_INFO(0, timeout_ms) // Optional
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_bpf_ring_buffer_poll, 0, 0, 0)
+    ZEND_ARG_INFO(0, timeout_ms) // Optional
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_bpf_ring_buffer_consume, 0, 0, 0)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_bpf_get_syscall_fnname, 0, 0, 1)
     ZEND_ARG_INFO(0, name)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_bpf_invalidate_symcache, 0, 0, 0)
+    ZEND_ARG_INFO(0, pid) // Optional
+ZEND_END_ARG_INFO()
+
+#define arginfo_bpf_refresh_symcache arginfo_bpf_invalidate_symcache
+
 ZEND_BEGIN_ARG_INFO_EX(arginfo_bpf_load_func, 0, 0, 2)
     ZEND_ARG_INFO(0, fn)
     ZEND_ARG_INFO(0, prog_type)
@@ -1649,16 +4321,83 @@ ZEND_END_ARG_INFO()
 
 /* {{{ arginfo for PerfEventArrayTable class */
 ZEND_BEGIN_ARG_INFO_EX(arginfo_perf_event_array_table_open_perf_buffer, 0, 0, 1)
-    ZEND_ARG_INFO(0, cb_fn_str)
+    ZEND_ARG_CALLABLE_INFO(0, callback, 0)
+    ZEND_ARG_ARRAY_INFO(0, options, 1)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_perf_event_array_table_stats, 0, 0, 0)
+ZEND_END_ARG_INFO()
+/* }}} */
+
+/* {{{ arginfo for RingBufTable class */
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ring_buf_table_open_ring_buffer, 0, 0, 1)
+    ZEND_ARG_CALLABLE_INFO(0, callback, 0)
 ZEND_END_ARG_INFO()
 /* }}} */
 
 /* {{{ arginfo for HashTable class */
 ZEND_BEGIN_ARG_INFO_EX(arginfo_hash_table_values, 0, 0, 0)
+    ZEND_ARG_ARRAY_INFO(0, options, 1) // Optional
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_hash_table_clear, 0, 0, 0)
 ZEND_END_ARG_INFO()
+
+#define arginfo_hash_table_drain arginfo_hash_table_values
+
+#define arginfo_hash_table_values_packed arginfo_hash_table_values
+
+#define arginfo_hash_table_deltas arginfo_hash_table_values
+
+#define arginfo_hash_table_histograms arginfo_hash_table_values
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_hash_table_print_log2_hist, 0, 0, 1)
+    ZEND_ARG_INFO(0, header)
+    ZEND_ARG_INFO(0, section_header) // Optional
+    ZEND_ARG_ARRAY_INFO(0, options, 1) // Optional
+ZEND_END_ARG_INFO()
+
+#define arginfo_hash_table_print_linear_hist arginfo_hash_table_print_log2_hist
+
+#define arginfo_hash_table_format_log2_hist arginfo_hash_table_print_log2_hist
+
+#define arginfo_hash_table_format_linear_hist arginfo_hash_table_print_log2_hist
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_hash_table_get, 0, 0, 1)
+    ZEND_ARG_INFO(0, key)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_hash_table_set, 0, 0, 2)
+    ZEND_ARG_INFO(0, key)
+    ZEND_ARG_INFO(0, value)
+    ZEND_ARG_INFO(0, flags) // Optional
+ZEND_END_ARG_INFO()
+
+#define arginfo_hash_table_delete arginfo_hash_table_get
+
+#define arginfo_hash_table_exists arginfo_hash_table_get
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_hash_table_get_many, 0, 0, 1)
+    ZEND_ARG_ARRAY_INFO(0, keys, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_hash_table_set_many, 0, 0, 2)
+    ZEND_ARG_ARRAY_INFO(0, keys, 0)
+    ZEND_ARG_ARRAY_INFO(0, values, 0)
+    ZEND_ARG_INFO(0, flags) // Optional
+ZEND_END_ARG_INFO()
+
+#define arginfo_hash_table_delete_many arginfo_hash_table_get_many
+
+#if PHP_VERSION_ID >= 80000
+ZEND_BEGIN_ARG_WITH_RETURN_OBJ_INFO_EX(arginfo_hash_table_get_iterator, 0, 0, Iterator, 0)
+ZEND_END_ARG_INFO()
+#endif
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_hash_table_set_schema, 0, 0, 0)
+    ZEND_ARG_INFO(0, leaf) // Optional
+    ZEND_ARG_INFO(0, key) // Optional
+ZEND_END_ARG_INFO()
 /* }}} */
 
 /* {{{ arginfo for ArrayTable class */
@@ -1668,15 +4407,77 @@ ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_array_table_print_log2_hist, 0, 0, 1)
     ZEND_ARG_INFO(0, header)
+    ZEND_ARG_ARRAY_INFO(0, options, 1) // Optional
 ZEND_END_ARG_INFO()
 
 #define arginfo_array_table_print_linear_hist arginfo_array_table_print_log2_hist
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_array_table_format_log2_hist, 0, 0, 1)
+    ZEND_ARG_INFO(0, header)
+ZEND_END_ARG_INFO()
+
+#define arginfo_array_table_format_linear_hist arginfo_array_table_format_log2_hist
+
+#define arginfo_array_table_values arginfo_hash_table_values
+
+#define arginfo_array_table_histogram arginfo_hash_table_values
 /* }}} */
 
 /* {{{ arginfo for PerCpuArrayTable class */
 ZEND_BEGIN_ARG_INFO_EX(arginfo_per_cpu_array_table_sum_value, 0, 0, 1)
     ZEND_ARG_INFO(0, index)
 ZEND_END_ARG_INFO()
+
+#define arginfo_per_cpu_array_table_sum_all arginfo_hash_table_values
+
+#define arginfo_per_cpu_array_table_max_all arginfo_hash_table_values
+
+#define arginfo_per_cpu_array_table_min_all arginfo_hash_table_values
+/* }}} */
+
+/* {{{ arginfo for Histogram class */
+ZEND_BEGIN_ARG_INFO_EX(arginfo_histogram_log2, 0, 0, 1)
+    ZEND_ARG_ARRAY_INFO(0, counts, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_histogram_linear, 0, 0, 1)
+    ZEND_ARG_ARRAY_INFO(0, counts, 0)
+    ZEND_ARG_INFO(0, step) // Optional
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_histogram_buckets, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+#define arginfo_histogram_total arginfo_histogram_buckets
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_histogram_percentile, 0, 0, 1)
+    ZEND_ARG_INFO(0, p)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_histogram_percentiles, 0, 0, 0)
+    ZEND_ARG_ARRAY_INFO(0, ps, 1) // Optional
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_histogram_merge, 0, 0, 0)
+    ZEND_ARG_VARIADIC_OBJ_INFO(0, others, Histogram, 0)
+ZEND_END_ARG_INFO()
+/* }}} */
+
+/* {{{ arginfo for Profile class */
+ZEND_BEGIN_ARG_INFO_EX(arginfo_profile_add, 0, 0, 2)
+    ZEND_ARG_ARRAY_INFO(0, frames, 0)
+    ZEND_ARG_INFO(0, value)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_profile_size, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+#define arginfo_profile_folded arginfo_profile_size
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_profile_pprof, 0, 0, 0)
+    ZEND_ARG_INFO(0, sample_type) // Optional
+    ZEND_ARG_INFO(0, unit) // Optional
+ZEND_END_ARG_INFO()
 /* }}} */
 
 /* {{{ arginfo for StackTraceTable class */
@@ -1684,6 +4485,18 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_stack_trace_table_values, 0, 0, 1)
     ZEND_ARG_INFO(0, stack_id)
     ZEND_ARG_INFO(0, pid) // Optional
 ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_stack_trace_table_export_profile, 0, 0, 2)
+    ZEND_ARG_INFO(0, counts)
+    ZEND_ARG_INFO(0, path)
+    ZEND_ARG_ARRAY_INFO(0, options, 1) // Optional
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_stack_trace_table_values_many, 0, 0, 1)
+    ZEND_ARG_ARRAY_INFO(0, stack_ids, 0)
+    ZEND_ARG_INFO(0, pid) // Optional
+    ZEND_ARG_ARRAY_INFO(0, options, 1) // Optional
+ZEND_END_ARG_INFO()
 /* }}} */
 
 
@@ -1700,6 +4513,9 @@ PHP_INI_END()
 static const zend_function_entry bpf_class_methods[] = {
 		PHP_ME(Bpf, __construct, arginfo_bpf_construct, ZEND_ACC_PUBLIC | ZEND_ACC_CTOR)
 		PHP_ME(Bpf, __get, arginfo_bpf_get, ZEND_ACC_PUBLIC)
+	PHP_ME(Bpf, from_cache, arginfo_bpf_from_cache, ZEND_ACC_PUBLIC)
+	PHP_ME(Bpf, free_bcc_memory, arginfo_bpf_free_bcc_memory, ZEND_ACC_PUBLIC)
+	PHP_ME(Bpf, bcc_memory_reclaimed, arginfo_bpf_bcc_memory_reclaimed, ZEND_ACC_PUBLIC)
 	PHP_ME(Bpf, get_kprobe_functions, arginfo_bpf_get_kprobe_functions, ZEND_ACC_PUBLIC)
 	PHP_ME(Bpf, attach_kprobe, arginfo_bpf_attach_kprobe, ZEND_ACC_PUBLIC)
 	PHP_ME(Bpf, attach_tracepoint, arginfo_bpf_attach_tracepoint, ZEND_ACC_PUBLIC)
@@ -1713,7 +4529,11 @@ static const zend_function_entry bpf_class_methods[] = {
 	PHP_ME(Bpf, trace_fields, arginfo_bpf_trace_fields, ZEND_ACC_PUBLIC)
 	PHP_ME(Bpf, get_table, arginfo_bpf_get_table, ZEND_ACC_PUBLIC)
 	PHP_ME(Bpf, perf_buffer_poll, arginfo_bpf_perf_buffer_poll, ZEND_ACC_PUBLIC)
+	PHP_ME(Bpf, ring_buffer_poll, arginfo_bpf_ring_buffer_poll, ZEND_ACC_PUBLIC)
+	PHP_ME(Bpf, ring_buffer_consume, arginfo_bpf_ring_buffer_consume, ZEND_ACC_PUBLIC)
 	PHP_ME(Bpf, get_syscall_fnname, arginfo_bpf_get_syscall_fnname, ZEND_ACC_PUBLIC)
+	PHP_ME(Bpf, invalidate_symcache, arginfo_bpf_invalidate_symcache, ZEND_ACC_PUBLIC)
+	PHP_ME(Bpf, refresh_symcache, arginfo_bpf_refresh_symcache, ZEND_ACC_PUBLIC)
 	PHP_ME(Bpf, load_func, arginfo_bpf_load_func, ZEND_ACC_PUBLIC)
 	PHP_ME(Bpf, attach_raw_socket, arginfo_bpf_attach_raw_socket, ZEND_ACC_PUBLIC)
 	PHP_FE_END
@@ -1723,19 +4543,50 @@ static const zend_function_entry bpf_class_methods[] = {
 /* {{{ table methods */
 static const zend_function_entry perf_event_array_table_methods[] = {
 	PHP_ME(PerfEventArrayTable, open_perf_buffer, arginfo_perf_event_array_table_open_perf_buffer, ZEND_ACC_PUBLIC)
+	PHP_ME(PerfEventArrayTable, stats, arginfo_perf_event_array_table_stats, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(HashTable, set_schema, set_schema, arginfo_hash_table_set_schema, ZEND_ACC_PUBLIC)
 	PHP_FE_END
 };
 
 static const zend_function_entry hash_table_methods[] = {
 	PHP_ME(HashTable, values, arginfo_hash_table_values, ZEND_ACC_PUBLIC)
+	PHP_ME(HashTable, values_packed, arginfo_hash_table_values_packed, ZEND_ACC_PUBLIC)
 	PHP_ME(HashTable, clear, arginfo_hash_table_clear, ZEND_ACC_PUBLIC)
+	PHP_ME(HashTable, drain, arginfo_hash_table_drain, ZEND_ACC_PUBLIC)
+	PHP_ME(HashTable, deltas, arginfo_hash_table_deltas, ZEND_ACC_PUBLIC)
+	PHP_ME(HashTable, get, arginfo_hash_table_get, ZEND_ACC_PUBLIC)
+	PHP_ME(HashTable, set, arginfo_hash_table_set, ZEND_ACC_PUBLIC)
+	PHP_ME(HashTable, delete, arginfo_hash_table_delete, ZEND_ACC_PUBLIC)
+	PHP_ME(HashTable, exists, arginfo_hash_table_exists, ZEND_ACC_PUBLIC)
+	PHP_ME(HashTable, get_many, arginfo_hash_table_get_many, ZEND_ACC_PUBLIC)
+	PHP_ME(HashTable, set_many, arginfo_hash_table_set_many, ZEND_ACC_PUBLIC)
+	PHP_ME(HashTable, delete_many, arginfo_hash_table_delete_many, ZEND_ACC_PUBLIC)
+	PHP_ME(HashTable, set_schema, arginfo_hash_table_set_schema, ZEND_ACC_PUBLIC)
+	PHP_ME(HashTable, histograms, arginfo_hash_table_histograms, ZEND_ACC_PUBLIC)
+	PHP_ME(HashTable, print_log2_hist, arginfo_hash_table_print_log2_hist, ZEND_ACC_PUBLIC)
+	PHP_ME(HashTable, print_linear_hist, arginfo_hash_table_print_linear_hist, ZEND_ACC_PUBLIC)
+	PHP_ME(HashTable, format_log2_hist, arginfo_hash_table_format_log2_hist, ZEND_ACC_PUBLIC)
+	PHP_ME(HashTable, format_linear_hist, arginfo_hash_table_format_linear_hist, ZEND_ACC_PUBLIC)
+#if PHP_VERSION_ID >= 80000
+	PHP_ME(HashTable, getIterator, arginfo_hash_table_get_iterator, ZEND_ACC_PUBLIC)
+#endif
 	PHP_FE_END
 };
 
 static const zend_function_entry array_table_methods[] = {
 	PHP_ME(ArrayTable, get_value, arginfo_array_table_get_value, ZEND_ACC_PUBLIC)
+	PHP_ME(ArrayTable, values, arginfo_array_table_values, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(HashTable, values_packed, values_packed, arginfo_hash_table_values_packed, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(HashTable, deltas, deltas, arginfo_hash_table_deltas, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(HashTable, set_schema, set_schema, arginfo_hash_table_set_schema, ZEND_ACC_PUBLIC)
 	PHP_ME(ArrayTable, print_log2_hist, arginfo_array_table_print_log2_hist, ZEND_ACC_PUBLIC)
 	PHP_ME(ArrayTable, print_linear_hist, arginfo_array_table_print_linear_hist, ZEND_ACC_PUBLIC)
+	PHP_ME(ArrayTable, format_log2_hist, arginfo_array_table_format_log2_hist, ZEND_ACC_PUBLIC)
+	PHP_ME(ArrayTable, format_linear_hist, arginfo_array_table_format_linear_hist, ZEND_ACC_PUBLIC)
+	PHP_ME(ArrayTable, histogram, arginfo_array_table_histogram, ZEND_ACC_PUBLIC)
+#if PHP_VERSION_ID >= 80000
+	PHP_MALIAS(HashTable, getIterator, getIterator, arginfo_hash_table_get_iterator, ZEND_ACC_PUBLIC)
+#endif
 	PHP_FE_END
 };
 
@@ -1744,11 +4595,35 @@ static const zend_function_entry prog_array_table_methods[] = {
 };
 
 static const zend_function_entry per_cpu_hash_table_methods[] = {
+	PHP_MALIAS(HashTable, get, get, arginfo_hash_table_get, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(HashTable, set, set, arginfo_hash_table_set, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(HashTable, delete, delete, arginfo_hash_table_delete, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(HashTable, exists, exists, arginfo_hash_table_exists, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(HashTable, get_many, get_many, arginfo_hash_table_get_many, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(HashTable, set_many, set_many, arginfo_hash_table_set_many, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(HashTable, delete_many, delete_many, arginfo_hash_table_delete_many, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(HashTable, set_schema, set_schema, arginfo_hash_table_set_schema, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(PerCpuArrayTable, sum_all, sum_all, arginfo_per_cpu_array_table_sum_all, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(PerCpuArrayTable, max_all, max_all, arginfo_per_cpu_array_table_max_all, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(PerCpuArrayTable, min_all, min_all, arginfo_per_cpu_array_table_min_all, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(HashTable, histograms, histograms, arginfo_hash_table_histograms, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(HashTable, print_log2_hist, print_log2_hist, arginfo_hash_table_print_log2_hist, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(HashTable, print_linear_hist, print_linear_hist, arginfo_hash_table_print_linear_hist, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(HashTable, format_log2_hist, format_log2_hist, arginfo_hash_table_format_log2_hist, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(HashTable, format_linear_hist, format_linear_hist, arginfo_hash_table_format_linear_hist, ZEND_ACC_PUBLIC)
+#if PHP_VERSION_ID >= 80000
+	PHP_MALIAS(HashTable, getIterator, getIterator, arginfo_hash_table_get_iterator, ZEND_ACC_PUBLIC)
+#endif
 	PHP_FE_END
 };
 
 static const zend_function_entry per_cpu_array_table_methods[] = {
 		PHP_ME(PerCpuArrayTable, sum_value, arginfo_per_cpu_array_table_sum_value, ZEND_ACC_PUBLIC)
+		PHP_ME(PerCpuArrayTable, sum_all, arginfo_per_cpu_array_table_sum_all, ZEND_ACC_PUBLIC)
+		PHP_ME(PerCpuArrayTable, max_all, arginfo_per_cpu_array_table_max_all, ZEND_ACC_PUBLIC)
+		PHP_ME(PerCpuArrayTable, min_all, arginfo_per_cpu_array_table_min_all, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, deltas, deltas, arginfo_hash_table_deltas, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(ArrayTable, histogram, histogram, arginfo_array_table_histogram, ZEND_ACC_PUBLIC)
 		PHP_FE_END
 };
 
@@ -1758,14 +4633,48 @@ static const zend_function_entry lpm_trie_table_methods[] = {
 
 static const zend_function_entry stack_trace_table_methods[] = {
 		PHP_ME(StackTraceTable, values, arginfo_stack_trace_table_values, ZEND_ACC_PUBLIC)
+		PHP_ME(StackTraceTable, values_many, arginfo_stack_trace_table_values_many, ZEND_ACC_PUBLIC)
+		PHP_ME(StackTraceTable, export_profile, arginfo_stack_trace_table_export_profile, ZEND_ACC_PUBLIC)
 		PHP_FE_END
 };
 
 static const zend_function_entry lru_hash_table_methods[] = {
+		PHP_MALIAS(HashTable, get, get, arginfo_hash_table_get, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, set, set, arginfo_hash_table_set, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, delete, delete, arginfo_hash_table_delete, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, exists, exists, arginfo_hash_table_exists, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, get_many, get_many, arginfo_hash_table_get_many, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, set_many, set_many, arginfo_hash_table_set_many, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, delete_many, delete_many, arginfo_hash_table_delete_many, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, set_schema, set_schema, arginfo_hash_table_set_schema, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, histograms, histograms, arginfo_hash_table_histograms, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, print_log2_hist, print_log2_hist, arginfo_hash_table_print_log2_hist, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, print_linear_hist, print_linear_hist, arginfo_hash_table_print_linear_hist, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, format_log2_hist, format_log2_hist, arginfo_hash_table_format_log2_hist, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, format_linear_hist, format_linear_hist, arginfo_hash_table_format_linear_hist, ZEND_ACC_PUBLIC)
+#if PHP_VERSION_ID >= 80000
+		PHP_MALIAS(HashTable, getIterator, getIterator, arginfo_hash_table_get_iterator, ZEND_ACC_PUBLIC)
+#endif
 		PHP_FE_END
 };
 
 static const zend_function_entry lru_per_cpu_hash_table_methods[] = {
+		PHP_MALIAS(HashTable, get, get, arginfo_hash_table_get, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, set, set, arginfo_hash_table_set, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, delete, delete, arginfo_hash_table_delete, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, exists, exists, arginfo_hash_table_exists, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, get_many, get_many, arginfo_hash_table_get_many, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, set_many, set_many, arginfo_hash_table_set_many, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, delete_many, delete_many, arginfo_hash_table_delete_many, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, set_schema, set_schema, arginfo_hash_table_set_schema, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(PerCpuArrayTable, sum_all, sum_all, arginfo_per_cpu_array_table_sum_all, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(PerCpuArrayTable, max_all, max_all, arginfo_per_cpu_array_table_max_all, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(PerCpuArrayTable, min_all, min_all, arginfo_per_cpu_array_table_min_all, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, histograms, histograms, arginfo_hash_table_histograms, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, print_log2_hist, print_log2_hist, arginfo_hash_table_print_log2_hist, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, print_linear_hist, print_linear_hist, arginfo_hash_table_print_linear_hist, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, format_log2_hist, format_log2_hist, arginfo_hash_table_format_log2_hist, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, format_linear_hist, format_linear_hist, arginfo_hash_table_format_linear_hist, ZEND_ACC_PUBLIC)
 		PHP_FE_END
 };
 
@@ -1798,12 +4707,35 @@ static const zend_function_entry queue_stack_table_methods[] = {
 };
 
 static const zend_function_entry ring_buf_table_methods[] = {
+		PHP_ME(RingBufTable, open_ring_buffer, arginfo_ring_buf_table_open_ring_buffer, ZEND_ACC_PUBLIC)
+		PHP_MALIAS(HashTable, set_schema, set_schema, arginfo_hash_table_set_schema, ZEND_ACC_PUBLIC)
 		PHP_FE_END
 };
 
 static const zend_function_entry bpf_prog_func_methods[] = {
 		PHP_FE_END
 };
+
+static const zend_function_entry histogram_methods[] = {
+		PHP_ME(Histogram, log2, arginfo_histogram_log2, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+		PHP_ME(Histogram, linear, arginfo_histogram_linear, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+		PHP_ME(Histogram, buckets, arginfo_histogram_buckets, ZEND_ACC_PUBLIC)
+		PHP_ME(Histogram, total, arginfo_histogram_total, ZEND_ACC_PUBLIC)
+		PHP_ME(Histogram, percentile, arginfo_histogram_percentile, ZEND_ACC_PUBLIC)
+		PHP_ME(Histogram, percentiles, arginfo_histogram_percentiles, ZEND_ACC_PUBLIC)
+		PHP_ME(Histogram, merge, arginfo_histogram_merge, ZEND_ACC_PUBLIC)
+		PHP_FE_END
+};
+/* }}} */
+
+/* {{{ profile_methods */
+static const zend_function_entry profile_methods[] = {
+		PHP_ME(Profile, add, arginfo_profile_add, ZEND_ACC_PUBLIC)
+		PHP_ME(Profile, size, arginfo_profile_size, ZEND_ACC_PUBLIC)
+		PHP_ME(Profile, folded, arginfo_profile_folded, ZEND_ACC_PUBLIC)
+		PHP_ME(Profile, pprof, arginfo_profile_pprof, ZEND_ACC_PUBLIC)
+		PHP_FE_END
+};
 /* }}} */
 
 
@@ -1812,13 +4744,16 @@ PHP_MINIT_FUNCTION (ebpf) {
 
 	memcpy(&bpf_object_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
 	bpf_object_handlers.offset = XtOffsetOf(bpf_object, std);
+	bpf_object_handlers.dtor_obj = bpf_dtor_object;
 	bpf_object_handlers.free_obj = bpf_free_object;
+	bpf_object_handlers.get_gc = bpf_get_gc;
 
 	REGISTER_BPF_CLASS(ce, bpf_create_object, "Bpf", bpf_ce, bpf_class_methods)
 
 	memcpy(&table_object_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
 	table_object_handlers.offset = XtOffsetOf(sub_object, std);
 	table_object_handlers.free_obj = table_free_object;
+	table_object_handlers.get_gc = table_get_gc;
 
 	REGISTER_BPF_CLASS(ce, table_create_object, "PerCpuArrayTable", per_cpu_array_table_ce, per_cpu_array_table_methods)
 	REGISTER_BPF_CLASS(ce, table_create_object, "PerfEventArrayTable", perf_event_array_table_ce,
@@ -1844,6 +4779,23 @@ PHP_MINIT_FUNCTION (ebpf) {
 	REGISTER_BPF_CLASS(ce, table_create_object, "RingBufTable", ring_buf_table_ce, ring_buf_table_methods)
 	REGISTER_BPF_CLASS(ce, table_create_object, "BPFProgFunction", bpf_prog_func_ce, bpf_prog_func_methods)
 
+	memcpy(&histogram_object_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+	histogram_object_handlers.offset = XtOffsetOf(histogram_object, std);
+	histogram_object_handlers.free_obj = histogram_free_object;
+
+	REGISTER_BPF_CLASS(ce, histogram_create_object, "Histogram", histogram_ce, histogram_methods)
+
+	memcpy(&profile_object_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+	profile_object_handlers.offset = XtOffsetOf(profile_object, std);
+	profile_object_handlers.free_obj = profile_free_object;
+
+	REGISTER_BPF_CLASS(ce, profile_create_object, "Profile", profile_ce, profile_methods)
+
+	table_register_iterator(hash_table_ce);
+	table_register_iterator(lru_hash_table_ce);
+	table_register_iterator(per_cpu_hash_table_ce);
+	table_register_iterator(array_table_ce);
+
 	/* Register constants */
 	REGISTER_BPF_CONST(SOCKET_FILTER);
 	REGISTER_BPF_CONST(KPROBE);
@@ -1866,6 +4818,11 @@ PHP_MINIT_FUNCTION (ebpf) {
 	REGISTER_BPF_CONST(CGROUP_SOCKOPT);
 	REGISTER_BPF_CONST(TRACING);
 	REGISTER_BPF_CONST(LSM);
+
+	/* Update flags for HashTable::set() and set_many() */
+	zend_declare_class_constant_long(bpf_ce, "ANY", sizeof("ANY") - 1, BPF_ANY);
+	zend_declare_class_constant_long(bpf_ce, "NOEXIST", sizeof("NOEXIST") - 1, BPF_NOEXIST);
+	zend_declare_class_constant_long(bpf_ce, "EXIST", sizeof("EXIST") - 1, BPF_EXIST);
 	return SUCCESS;
 }
 
@@ -0,0 +1,114 @@
+/*
+  +----------------------------------------------------------------------+
+  | PHP Version 7, 8                                                     |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 1997-2018 The PHP Group                                |
+  +----------------------------------------------------------------------+
+  | This source file is subject to version 3.01 of the PHP license,      |
+  | that is bundled with this package in the file LICENSE, and is        |
+  | available through the world-wide-web at the following url:           |
+  | http://www.php.net/license/3_01.txt                                  |
+  | If you did not receive a copy of the PHP license and are unable to   |
+  | obtain it through the world-wide-web, please send a note to          |
+  | license@php.net so we can mail you a copy immediately.               |
+  +----------------------------------------------------------------------+
+  | Author: carl.guo a631929063@gmail.com                                |
+  +----------------------------------------------------------------------+
+*/
+
+#include "ebpf_hist.h"
+
+#include <algorithm>
+
+namespace {
+
+size_t used_slots(const std::vector<uint64_t> &slots) {
+	size_t n = slots.size();
+	while (n > 0 && slots[n - 1] == 0)
+		n--;
+	return n;
+}
+
+}  // namespace
+
+Histogram Histogram::log2(const std::vector<uint64_t> &slots) {
+	Histogram h;
+	size_t n = std::min(used_slots(slots), (size_t) 65);
+	h.buckets_.reserve(n);
+	for (size_t i = 0; i < n; i++) {
+		uint64_t low = i == 0 ? 0 : 1ULL << (i - 1);
+		uint64_t high = i == 0 ? 0 : (i == 64 ? ~0ULL : (1ULL << i) - 1);
+		h.buckets_.push_back({low, high, slots[i]});
+	}
+	return h;
+}
+
+Histogram Histogram::linear(const std::vector<uint64_t> &slots, uint64_t step) {
+	Histogram h;
+	size_t n = used_slots(slots);
+	if (step == 0)
+		step = 1;
+	h.buckets_.reserve(n);
+	for (size_t i = 0; i < n; i++) {
+		h.buckets_.push_back({i * step, (i + 1) * step - 1, slots[i]});
+	}
+	return h;
+}
+
+uint64_t Histogram::total() const {
+	uint64_t sum = 0;
+	for (const auto &b: buckets_)
+		sum += b.count;
+	return sum;
+}
+
+double Histogram::percentile(double p) const {
+	uint64_t sum = total();
+	if (sum == 0)
+		return -1;
+
+	p = p < 0 ? 0 : (p > 100 ? 100 : p);
+	double target = p / 100.0 * (double) sum;
+	double seen = 0;
+	for (const auto &b: buckets_) {
+		if (b.count == 0)
+			continue;
+		if (seen + (double) b.count >= target) {
+			double frac = (target - seen) / (double) b.count;
+			double value = (double) b.low + frac * ((double) (b.high - b.low) + 1.0);
+			return std::min(value, (double) b.high);
+		}
+		seen += (double) b.count;
+	}
+	return (double) buckets_.back().high;
+}
+
+bool Histogram::merge(const Histogram &other, std::string &err) {
+	std::vector<Bucket> out;
+	out.reserve(buckets_.size() + other.buckets_.size());
+
+	size_t i = 0, j = 0;
+	const std::vector<Bucket> &a = buckets_, &b = other.buckets_;
+	while (i < a.size() || j < b.size()) {
+		if (j == b.size() || (i < a.size() && a[i].high < b[j].low)) {
+			out.push_back(a[i++]);
+		} else if (i == a.size() || b[j].high < a[i].low) {
+			out.push_back(b[j++]);
+		} else if (a[i].low == b[j].low && a[i].high == b[j].high) {
+			out.push_back({a[i].low, a[i].high, a[i].count + b[j].count});
+			i++;
+			j++;
+		} else if (a[i].count == 0) {
+			i++;
+		} else if (b[j].count == 0) {
+			j++;
+		} else {
+			err = "bucket " + std::to_string(a[i].low) + "-" + std::to_string(a[i].high) +
+			      " overlaps bucket " + std::to_string(b[j].low) + "-" + std::to_string(b[j].high);
+			return false;
+		}
+	}
+
+	buckets_.swap(out);
+	return true;
+}
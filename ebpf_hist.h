@@ -0,0 +1,86 @@
+/*
+  +----------------------------------------------------------------------+
+  | PHP Version 7, 8                                                     |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 1997-2018 The PHP Group                                |
+  +----------------------------------------------------------------------+
+  | This source file is subject to version 3.01 of the PHP license,      |
+  | that is bundled with this package in the file LICENSE, and is        |
+  | available through the world-wide-web at the following url:           |
+  | http://www.php.net/license/3_01.txt                                  |
+  | If you did not receive a copy of the PHP license and are unable to   |
+  | obtain it through the world-wide-web, please send a note to          |
+  | license@php.net so we can mail you a copy immediately.               |
+  +----------------------------------------------------------------------+
+  | Author: carl.guo a631929063@gmail.com                                |
+  +----------------------------------------------------------------------+
+*/
+
+#ifndef EBPF_HIST_H
+#define EBPF_HIST_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Distribution read from a BPF histogram table
+ *
+ * Slots filled by bpf_log2l() or by a linear bucket index are turned into
+ * buckets with explicit value bounds, so histograms of different layouts
+ * can be merged and queried for percentiles without going back to PHP.
+ */
+class Histogram {
+public:
+	struct Bucket {
+		uint64_t low;
+		uint64_t high;
+		uint64_t count;
+	};
+
+	/**
+	 * @brief Build from log2 slots: slot 0 holds 0, slot i holds [2^(i-1), 2^i - 1]
+	 */
+	static Histogram log2(const std::vector<uint64_t> &slots);
+
+	/**
+	 * @brief Build from linear slots: slot i holds [i * step, (i + 1) * step - 1]
+	 */
+	static Histogram linear(const std::vector<uint64_t> &slots, uint64_t step);
+
+	/**
+	 * @brief Buckets ordered by value, up to the last non-empty one
+	 */
+	const std::vector<Bucket> &buckets() const { return buckets_; }
+
+	/**
+	 * @brief Number of samples in all buckets
+	 */
+	uint64_t total() const;
+
+	/**
+	 * @brief Value below which p percent of the samples fall
+	 *
+	 * The position inside the selected bucket is interpolated linearly.
+	 *
+	 * @param p Percentile in [0, 100]
+	 * @return Estimated value, or -1 for an empty histogram
+	 */
+	double percentile(double p) const;
+
+	/**
+	 * @brief Add the samples of another histogram
+	 *
+	 * Buckets with the same bounds are summed, disjoint buckets are kept side
+	 * by side. Empty buckets give way to overlapping ones.
+	 *
+	 * @param err Receives the reason when two non-empty buckets overlap
+	 * @return false if the layouts cannot be combined; this histogram is unchanged
+	 */
+	bool merge(const Histogram &other, std::string &err);
+
+private:
+	std::vector<Bucket> buckets_;
+};
+
+#endif    /* EBPF_HIST_H */
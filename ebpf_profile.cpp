@@ -0,0 +1,185 @@
+/*
+  +----------------------------------------------------------------------+
+  | PHP Version 7, 8                                                     |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 1997-2018 The PHP Group                                |
+  +----------------------------------------------------------------------+
+  | This source file is subject to version 3.01 of the PHP license,      |
+  | that is bundled with this package in the file LICENSE, and is        |
+  | available through the world-wide-web at the following url:           |
+  | http://www.php.net/license/3_01.txt                                  |
+  | If you did not receive a copy of the PHP license and are unable to   |
+  | obtain it through the world-wide-web, please send a note to          |
+  | license@php.net so we can mail you a copy immediately.               |
+  +----------------------------------------------------------------------+
+  | Author: carl.guo a631929063@gmail.com                                |
+  +----------------------------------------------------------------------+
+*/
+
+#include "ebpf_profile.h"
+
+#include <algorithm>
+
+namespace {
+
+/* Minimal protobuf encoding, just what profile.proto needs */
+enum {
+	WIRE_VARINT = 0,
+	WIRE_BYTES = 2
+};
+
+void put_varint(std::string &out, uint64_t v) {
+	while (v >= 0x80) {
+		out += (char) (v | 0x80);
+		v >>= 7;
+	}
+	out += (char) v;
+}
+
+void put_tag(std::string &out, int field, int wire) {
+	put_varint(out, ((uint64_t) field << 3) | wire);
+}
+
+void put_uint(std::string &out, int field, uint64_t v) {
+	put_tag(out, field, WIRE_VARINT);
+	put_varint(out, v);
+}
+
+void put_bytes(std::string &out, int field, const std::string &data) {
+	put_tag(out, field, WIRE_BYTES);
+	put_varint(out, data.size());
+	out += data;
+}
+
+/* Hands buf to the sink once it holds at least flush_size bytes, or always when force is set */
+bool flush(const ProfileBuilder::Sink &sink, std::string &buf, size_t flush_size, bool force) {
+	if (buf.empty() || (!force && buf.size() < flush_size))
+		return true;
+	bool ok = sink(buf.data(), buf.size());
+	buf.clear();
+	return ok;
+}
+
+// profile.proto field numbers
+enum {
+	PROFILE_SAMPLE_TYPE = 1,
+	PROFILE_SAMPLE = 2,
+	PROFILE_LOCATION = 4,
+	PROFILE_FUNCTION = 5,
+	PROFILE_STRING_TABLE = 6,
+	VALUE_TYPE_TYPE = 1,
+	VALUE_TYPE_UNIT = 2,
+	SAMPLE_LOCATION_ID = 1,
+	SAMPLE_VALUE = 2,
+	LOCATION_ID = 1,
+	LOCATION_LINE = 4,
+	LINE_FUNCTION_ID = 1,
+	FUNCTION_ID = 1,
+	FUNCTION_NAME = 2,
+	FUNCTION_SYSTEM_NAME = 3
+};
+
+}  // namespace
+
+uint64_t ProfileBuilder::intern(const std::string &name) {
+	auto it = ids_.find(name);
+	if (it != ids_.end())
+		return it->second;
+	names_.push_back(name);
+	ids_.emplace(name, names_.size());
+	return names_.size();
+}
+
+void ProfileBuilder::add(const std::vector<const std::string *> &frames, int64_t value) {
+	std::vector<uint64_t> stack;
+	stack.reserve(frames.size());
+	for (const auto *frame: frames)
+		stack.push_back(intern(*frame));
+	samples_[std::move(stack)] += value;
+}
+
+bool ProfileBuilder::write_folded(const Sink &sink, size_t flush_size) const {
+	std::vector<std::pair<std::string, int64_t>> lines;
+	lines.reserve(samples_.size());
+	for (const auto &sample: samples_) {
+		std::string line;
+		const auto &stack = sample.first;
+		for (size_t f = stack.size(); f-- > 0;) {
+			line += names_[stack[f] - 1];
+			if (f > 0)
+				line += ';';
+		}
+		lines.emplace_back(std::move(line), sample.second);
+	}
+	std::sort(lines.begin(), lines.end());
+
+	std::string buf;
+	buf.reserve(flush_size + 4096);
+	for (const auto &line: lines) {
+		buf += line.first;
+		buf += ' ';
+		buf += std::to_string(line.second);
+		buf += '\n';
+		if (!flush(sink, buf, flush_size, false))
+			return false;
+	}
+	return flush(sink, buf, flush_size, true);
+}
+
+bool ProfileBuilder::write_pprof(const Sink &sink, const std::string &sample_type, const std::string &unit,
+                                 size_t flush_size) const {
+	// String table: "" first as required, then function names, then the value type
+	uint64_t type_idx = names_.size() + 1;
+	uint64_t unit_idx = names_.size() + 2;
+
+	std::string buf, msg;
+	buf.reserve(flush_size + 4096);
+
+	put_uint(msg, VALUE_TYPE_TYPE, type_idx);
+	put_uint(msg, VALUE_TYPE_UNIT, unit_idx);
+	put_bytes(buf, PROFILE_SAMPLE_TYPE, msg);
+
+	std::string packed;
+	for (const auto &sample: samples_) {
+		msg.clear();
+		packed.clear();
+		for (auto id: sample.first)
+			put_varint(packed, id);
+		put_bytes(msg, SAMPLE_LOCATION_ID, packed);
+		packed.clear();
+		put_varint(packed, (uint64_t) sample.second);
+		put_bytes(msg, SAMPLE_VALUE, packed);
+		put_bytes(buf, PROFILE_SAMPLE, msg);
+		if (!flush(sink, buf, flush_size, false))
+			return false;
+	}
+
+	// One location and one function per name, sharing the same id
+	std::string line;
+	for (uint64_t id = 1; id <= names_.size(); id++) {
+		msg.clear();
+		line.clear();
+		put_uint(line, LINE_FUNCTION_ID, id);
+		put_uint(msg, LOCATION_ID, id);
+		put_bytes(msg, LOCATION_LINE, line);
+		put_bytes(buf, PROFILE_LOCATION, msg);
+
+		msg.clear();
+		put_uint(msg, FUNCTION_ID, id);
+		put_uint(msg, FUNCTION_NAME, id);
+		put_uint(msg, FUNCTION_SYSTEM_NAME, id);
+		put_bytes(buf, PROFILE_FUNCTION, msg);
+		if (!flush(sink, buf, flush_size, false))
+			return false;
+	}
+
+	put_bytes(buf, PROFILE_STRING_TABLE, std::string());
+	for (const auto &name: names_) {
+		put_bytes(buf, PROFILE_STRING_TABLE, name);
+		if (!flush(sink, buf, flush_size, false))
+			return false;
+	}
+	put_bytes(buf, PROFILE_STRING_TABLE, sample_type);
+	put_bytes(buf, PROFILE_STRING_TABLE, unit);
+	return flush(sink, buf, flush_size, true);
+}
@@ -0,0 +1,82 @@
+/*
+  +----------------------------------------------------------------------+
+  | PHP Version 7, 8                                                     |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 1997-2018 The PHP Group                                |
+  +----------------------------------------------------------------------+
+  | This source file is subject to version 3.01 of the PHP license,      |
+  | that is bundled with this package in the file LICENSE, and is        |
+  | available through the world-wide-web at the following url:           |
+  | http://www.php.net/license/3_01.txt                                  |
+  | If you did not receive a copy of the PHP license and are unable to   |
+  | obtain it through the world-wide-web, please send a note to          |
+  | license@php.net so we can mail you a copy immediately.               |
+  +----------------------------------------------------------------------+
+  | Author: carl.guo a631929063@gmail.com                                |
+  +----------------------------------------------------------------------+
+*/
+
+#ifndef EBPF_PROFILE_H
+#define EBPF_PROFILE_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Aggregated stack samples, written as folded stacks or as pprof
+ *
+ * Function names are interned once, so a profile of many stacks sharing
+ * the same frames stays small. Output goes to a sink in chunks instead of
+ * being assembled in one buffer.
+ */
+class ProfileBuilder {
+public:
+	/**
+	 * @brief Receives the output, in chunks of roughly flush_size bytes
+	 */
+	typedef std::function<bool(const char *data, size_t len)> Sink;
+
+	/**
+	 * @brief Add the value of one stack; identical stacks are summed
+	 * @param frames Function names, innermost frame first
+	 */
+	void add(const std::vector<const std::string *> &frames, int64_t value);
+
+	/**
+	 * @brief Number of distinct stacks
+	 */
+	size_t size() const { return samples_.size(); }
+
+	/**
+	 * @brief Write one "outer;...;inner value" line per stack, as read by flamegraph.pl
+	 *
+	 * Lines are sorted, like the output of stackcollapse scripts.
+	 *
+	 * @return false as soon as the sink fails
+	 */
+	bool write_folded(const Sink &sink, size_t flush_size = 65536) const;
+
+	/**
+	 * @brief Write an uncompressed profile.proto message, as read by pprof
+	 * @param sample_type Name of the sampled value, e.g. "samples" or "alloc_space"
+	 * @param unit Unit of the sampled value, e.g. "count" or "bytes"
+	 * @return false as soon as the sink fails
+	 */
+	bool write_pprof(const Sink &sink, const std::string &sample_type, const std::string &unit,
+	                 size_t flush_size = 65536) const;
+
+private:
+	uint64_t intern(const std::string &name);
+
+	// Function names, index + 1 is the function (and location) id
+	std::vector<std::string> names_;
+	std::unordered_map<std::string, uint64_t> ids_;
+	// Stacks as function ids, innermost first
+	std::map<std::vector<uint64_t>, int64_t> samples_;
+};
+
+#endif    /* EBPF_PROFILE_H */
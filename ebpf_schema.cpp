@@ -0,0 +1,812 @@
+/*
+  +----------------------------------------------------------------------+
+  | PHP Version 7, 8                                                     |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 1997-2018 The PHP Group                                |
+  +----------------------------------------------------------------------+
+  | This source file is subject to version 3.01 of the PHP license,      |
+  | that is bundled with this package in the file LICENSE, and is        |
+  | available through the world-wide-web at the following url:           |
+  | http://www.php.net/license/3_01.txt                                  |
+  | If you did not receive a copy of the PHP license and are unable to   |
+  | obtain it through the world-wide-web, please send a note to          |
+  | license@php.net so we can mail you a copy immediately.               |
+  +----------------------------------------------------------------------+
+  | Author: carl.guo a631929063@gmail.com                                |
+  +----------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+extern "C" {
+#include "php.h"
+}
+
+#include "ebpf_schema.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+
+namespace {
+
+typedef TableSchema::Type Type;
+typedef TableSchema::Field Field;
+
+struct JsonNode {
+	enum { J_STR, J_NUM, J_ARR } kind;
+	std::string str;
+	long num;
+	std::vector<JsonNode> arr;
+};
+
+// BCC descriptors only use arrays, strings and integers
+class JsonParser {
+public:
+	explicit JsonParser(const std::string &text) : s_(text), pos_(0) {}
+
+	bool parse(JsonNode &out) {
+		if (!value(out))
+			return false;
+		skip_ws();
+		return pos_ == s_.size();
+	}
+
+private:
+	void skip_ws() {
+		while (pos_ < s_.size() && isspace((unsigned char) s_[pos_]))
+			pos_++;
+	}
+
+	bool value(JsonNode &out) {
+		skip_ws();
+		if (pos_ >= s_.size())
+			return false;
+		char c = s_[pos_];
+		if (c == '"')
+			return string(out);
+		if (c == '[')
+			return array(out);
+		if (c == '-' || isdigit((unsigned char) c))
+			return number(out);
+		return false;
+	}
+
+	bool string(JsonNode &out) {
+		out.kind = JsonNode::J_STR;
+		pos_++;
+		while (pos_ < s_.size() && s_[pos_] != '"') {
+			if (s_[pos_] == '\\' && pos_ + 1 < s_.size())
+				pos_++;
+			out.str += s_[pos_++];
+		}
+		if (pos_ >= s_.size())
+			return false;
+		pos_++;
+		return true;
+	}
+
+	bool number(JsonNode &out) {
+		out.kind = JsonNode::J_NUM;
+		char *end = nullptr;
+		out.num = strtol(s_.c_str() + pos_, &end, 10);
+		size_t consumed = end - (s_.c_str() + pos_);
+		if (consumed == 0)
+			return false;
+		pos_ += consumed;
+		return true;
+	}
+
+	bool array(JsonNode &out) {
+		out.kind = JsonNode::J_ARR;
+		pos_++;
+		skip_ws();
+		if (pos_ < s_.size() && s_[pos_] == ']') {
+			pos_++;
+			return true;
+		}
+		while (true) {
+			JsonNode item;
+			if (!value(item))
+				return false;
+			out.arr.push_back(std::move(item));
+			skip_ws();
+			if (pos_ >= s_.size())
+				return false;
+			if (s_[pos_] == ',') {
+				pos_++;
+				continue;
+			}
+			if (s_[pos_] == ']') {
+				pos_++;
+				return true;
+			}
+			return false;
+		}
+	}
+
+	const std::string &s_;
+	size_t pos_;
+};
+
+struct FieldSpec {
+	std::string name;
+	std::shared_ptr<Type> type;
+	std::vector<size_t> dims;
+	int bit_size;
+	bool padding;
+};
+
+std::shared_ptr<Type> make_scalar(TableSchema::Kind kind, size_t size, bool is_char = false) {
+	auto t = std::make_shared<Type>();
+	t->kind = kind;
+	t->size = size;
+	t->align = size;
+	t->is_char = is_char;
+	return t;
+}
+
+std::string trim(const std::string &s) {
+	size_t b = s.find_first_not_of(" \t");
+	if (b == std::string::npos)
+		return "";
+	size_t e = s.find_last_not_of(" \t");
+	return s.substr(b, e - b + 1);
+}
+
+std::shared_ptr<Type> scalar_type(const std::string &raw, std::string &err) {
+	struct scalar_def {
+		const char *name;
+		TableSchema::Kind kind;
+		size_t size;
+	};
+	static const scalar_def defs[] = {
+			{"s8",                     TableSchema::KIND_INT,   1},
+			{"__s8",                   TableSchema::KIND_INT,   1},
+			{"int8_t",                 TableSchema::KIND_INT,   1},
+			{"signed char",            TableSchema::KIND_INT,   1},
+			{"u8",                     TableSchema::KIND_UINT,  1},
+			{"__u8",                   TableSchema::KIND_UINT,  1},
+			{"uint8_t",                TableSchema::KIND_UINT,  1},
+			{"unsigned char",          TableSchema::KIND_UINT,  1},
+			{"_Bool",                  TableSchema::KIND_UINT,  1},
+			{"bool",                   TableSchema::KIND_UINT,  1},
+			{"short",                  TableSchema::KIND_INT,   2},
+			{"short int",              TableSchema::KIND_INT,   2},
+			{"s16",                    TableSchema::KIND_INT,   2},
+			{"__s16",                  TableSchema::KIND_INT,   2},
+			{"int16_t",                TableSchema::KIND_INT,   2},
+			{"unsigned short",         TableSchema::KIND_UINT,  2},
+			{"unsigned short int",     TableSchema::KIND_UINT,  2},
+			{"u16",                    TableSchema::KIND_UINT,  2},
+			{"__u16",                  TableSchema::KIND_UINT,  2},
+			{"__be16",                 TableSchema::KIND_UINT,  2},
+			{"uint16_t",               TableSchema::KIND_UINT,  2},
+			{"int",                    TableSchema::KIND_INT,   4},
+			{"s32",                    TableSchema::KIND_INT,   4},
+			{"__s32",                  TableSchema::KIND_INT,   4},
+			{"int32_t",                TableSchema::KIND_INT,   4},
+			{"pid_t",                  TableSchema::KIND_INT,   4},
+			{"unsigned int",           TableSchema::KIND_UINT,  4},
+			{"unsigned",               TableSchema::KIND_UINT,  4},
+			{"u32",                    TableSchema::KIND_UINT,  4},
+			{"__u32",                  TableSchema::KIND_UINT,  4},
+			{"__be32",                 TableSchema::KIND_UINT,  4},
+			{"uint32_t",               TableSchema::KIND_UINT,  4},
+			{"long",                   TableSchema::KIND_INT,   8},
+			{"long int",               TableSchema::KIND_INT,   8},
+			{"long long",              TableSchema::KIND_INT,   8},
+			{"long long int",          TableSchema::KIND_INT,   8},
+			{"s64",                    TableSchema::KIND_INT,   8},
+			{"__s64",                  TableSchema::KIND_INT,   8},
+			{"int64_t",                TableSchema::KIND_INT,   8},
+			{"ssize_t",                TableSchema::KIND_INT,   8},
+			{"unsigned long",          TableSchema::KIND_UINT,  8},
+			{"unsigned long int",      TableSchema::KIND_UINT,  8},
+			{"unsigned long long",     TableSchema::KIND_UINT,  8},
+			{"unsigned long long int", TableSchema::KIND_UINT,  8},
+			{"u64",                    TableSchema::KIND_UINT,  8},
+			{"__u64",                  TableSchema::KIND_UINT,  8},
+			{"uint64_t",               TableSchema::KIND_UINT,  8},
+			{"size_t",                 TableSchema::KIND_UINT,  8},
+			{"uintptr_t",              TableSchema::KIND_UINT,  8},
+			{"float",                  TableSchema::KIND_FLOAT, 4},
+			{"double",                 TableSchema::KIND_FLOAT, 8},
+			{"__int128",               TableSchema::KIND_BYTES, 16},
+			{"unsigned __int128",      TableSchema::KIND_BYTES, 16},
+	};
+
+	std::string name = trim(raw);
+	if (name == "char")
+		return make_scalar(TableSchema::KIND_INT, 1, true);
+	if (!name.empty() && name.back() == '*')
+		return make_scalar(TableSchema::KIND_UINT, sizeof(void *));
+	if (name.compare(0, 5, "enum ") == 0 || name == "enum")
+		return make_scalar(TableSchema::KIND_UINT, 4);
+	for (const auto &def: defs) {
+		if (name == def.name)
+			return make_scalar(def.kind, def.size);
+	}
+	err = "unsupported type '" + name + "'";
+	return nullptr;
+}
+
+size_t align_up(size_t v, size_t align) {
+	return align > 1 ? (v + align - 1) / align * align : v;
+}
+
+size_t element_count(const std::vector<size_t> &dims) {
+	size_t n = 1;
+	for (size_t d: dims)
+		n *= d;
+	return n;
+}
+
+// Far above any map value or perf record; keeps decoding loops and
+// allocations bounded whatever the schema says
+const size_t MAX_ARRAY_DIM = 1 << 20;
+const size_t MAX_TYPE_SIZE = 1 << 24;
+
+bool add_dim(std::vector<size_t> &dims, long long n, std::string &err) {
+	if (n <= 0 || (unsigned long long) n > MAX_ARRAY_DIM) {
+		err = "array count " + std::to_string(n) + " out of range 1.." + std::to_string(MAX_ARRAY_DIM);
+		return false;
+	}
+	dims.push_back((size_t) n);
+	return true;
+}
+
+// Bytes taken by an element of the given size repeated over dims
+bool field_bytes(size_t size, const std::vector<size_t> &dims, size_t &bytes, std::string &err) {
+	bytes = size;
+	for (size_t d: dims) {
+		if (bytes > MAX_TYPE_SIZE / d) {
+			err = "array field larger than " + std::to_string(MAX_TYPE_SIZE) + " bytes";
+			return false;
+		}
+		bytes *= d;
+	}
+	return true;
+}
+
+// Bitfields sit in an integer unit of their base type and fit in it
+bool bit_size(const Type &t, const std::string &name, long n, int &bits, std::string &err) {
+	if (t.kind != TableSchema::KIND_INT && t.kind != TableSchema::KIND_UINT) {
+		err = "bitfield '" + name + "' must have an integer type";
+		return false;
+	}
+	if (n <= 0 || (size_t) n > t.size * 8) {
+		err = "bitfield '" + name + "' width " + std::to_string(n) + " out of range 1.." + std::to_string(t.size * 8);
+		return false;
+	}
+	bits = (int) n;
+	return true;
+}
+
+std::shared_ptr<Type> layout(std::vector<FieldSpec> &specs, bool is_union, bool packed, std::string &err) {
+	auto rec = std::make_shared<Type>();
+	rec->kind = TableSchema::KIND_RECORD;
+	rec->is_char = false;
+	rec->align = 1;
+
+	size_t bit_pos = 0;
+	size_t union_size = 0;
+
+	for (auto &spec: specs) {
+		const Type &t = *spec.type;
+		size_t falign = packed ? 1 : t.align;
+		Field f;
+		f.name = spec.name;
+		f.type = spec.type;
+		f.dims = spec.dims;
+		f.bit_offset = 0;
+		f.bit_size = spec.bit_size;
+		f.padding = spec.padding;
+
+		size_t fbits;
+		if (spec.bit_size > 0) {
+			size_t unit = t.size * 8;
+			if (!packed) {
+				size_t unit_start = bit_pos / unit * unit;
+				if (bit_pos + spec.bit_size > unit_start + unit)
+					bit_pos = unit_start + unit;
+				f.offset = bit_pos / unit * t.size;
+			} else {
+				f.offset = bit_pos / 8;
+			}
+			f.bit_offset = (int) (bit_pos - f.offset * 8);
+			fbits = spec.bit_size;
+		} else {
+			size_t byte_pos = align_up((bit_pos + 7) / 8, falign);
+			f.offset = byte_pos;
+			bit_pos = byte_pos * 8;
+			size_t bytes;
+			if (!field_bytes(t.size, spec.dims, bytes, err))
+				return nullptr;
+			fbits = bytes * 8;
+		}
+
+		if (is_union) {
+			f.offset = 0;
+			f.bit_offset = 0;
+			union_size = std::max(union_size, (fbits + 7) / 8);
+		} else {
+			bit_pos += fbits;
+			if ((bit_pos + 7) / 8 > MAX_TYPE_SIZE) {
+				err = "record larger than " + std::to_string(MAX_TYPE_SIZE) + " bytes";
+				return nullptr;
+			}
+		}
+
+		rec->align = std::max(rec->align, falign);
+		rec->fields.push_back(std::move(f));
+	}
+
+	size_t size = is_union ? union_size : (bit_pos + 7) / 8;
+	rec->size = align_up(size, rec->align);
+	return rec;
+}
+
+bool is_field_list(const JsonNode &n) {
+	return n.kind == JsonNode::J_ARR && (n.arr.empty() || n.arr[0].kind == JsonNode::J_ARR);
+}
+
+std::shared_ptr<Type> type_from_json(const JsonNode &n, std::string &err) {
+	if (n.kind == JsonNode::J_STR)
+		return scalar_type(n.str, err);
+
+	// ["name", [fields...], "struct" | "union" | "struct_packed"]
+	if (n.kind != JsonNode::J_ARR || n.arr.size() < 2 || !is_field_list(n.arr[1])) {
+		err = "malformed type descriptor";
+		return nullptr;
+	}
+
+	bool is_union = false;
+	bool packed = false;
+	if (n.arr.size() > 2 && n.arr[2].kind == JsonNode::J_STR) {
+		is_union = n.arr[2].str == "union";
+		packed = n.arr[2].str == "struct_packed";
+	}
+
+	std::vector<FieldSpec> specs;
+	for (const auto &fn: n.arr[1].arr) {
+		if (fn.kind != JsonNode::J_ARR || fn.arr.size() < 2 || fn.arr[0].kind != JsonNode::J_STR) {
+			err = "malformed field descriptor";
+			return nullptr;
+		}
+
+		FieldSpec spec;
+		spec.name = fn.arr[0].str;
+		spec.bit_size = 0;
+		spec.padding = spec.name.compare(0, 5, "__pad") == 0;
+
+		if (is_field_list(fn.arr[1])) {
+			// Nested struct or union, the field entry is itself the descriptor
+			spec.type = type_from_json(fn, err);
+		} else {
+			spec.type = type_from_json(fn.arr[1], err);
+			if (fn.arr.size() > 2 && fn.arr[2].kind == JsonNode::J_ARR) {
+				for (const auto &d: fn.arr[2].arr) {
+					if (d.kind == JsonNode::J_NUM && !add_dim(spec.dims, d.num, err))
+						return nullptr;
+				}
+			} else if (fn.arr.size() > 2 && fn.arr[2].kind == JsonNode::J_NUM) {
+				if (spec.type && !bit_size(*spec.type, spec.name, fn.arr[2].num, spec.bit_size, err))
+					return nullptr;
+			}
+		}
+		if (!spec.type)
+			return nullptr;
+		specs.push_back(std::move(spec));
+	}
+
+	return layout(specs, is_union, packed, err);
+}
+
+// Parse "type[N][M]" into the base type and its dimensions
+std::shared_ptr<Type> type_with_dims(const std::string &decl, std::vector<size_t> &dims, std::string &err) {
+	size_t bracket = decl.find('[');
+	std::string base = decl.substr(0, bracket);
+	while (bracket != std::string::npos) {
+		size_t close = decl.find(']', bracket);
+		if (close == std::string::npos) {
+			err = "malformed array type '" + decl + "'";
+			return nullptr;
+		}
+		char *end;
+		long long n = strtoll(decl.c_str() + bracket + 1, &end, 10);
+		if (end != decl.c_str() + close) {
+			err = "malformed array type '" + decl + "'";
+			return nullptr;
+		}
+		if (!add_dim(dims, n, err))
+			return nullptr;
+		bracket = decl.find('[', close);
+	}
+	return scalar_type(base, err);
+}
+
+std::shared_ptr<Type> type_from_zval(zval *spec, std::string &err);
+
+bool field_from_zval(zval *entry, FieldSpec &spec, std::string &err) {
+	if (Z_TYPE_P(entry) != IS_ARRAY) {
+		err = "each field must be an array [name, type] or [name, type, count]";
+		return false;
+	}
+
+	HashTable *ht = Z_ARRVAL_P(entry);
+	zval *name = zend_hash_index_find(ht, 0);
+	zval *type = zend_hash_index_find(ht, 1);
+	zval *count = zend_hash_index_find(ht, 2);
+	if (!name || !type || Z_TYPE_P(name) != IS_STRING) {
+		err = "each field must be an array [name, type] or [name, type, count]";
+		return false;
+	}
+
+	spec.name = std::string(Z_STRVAL_P(name), Z_STRLEN_P(name));
+	spec.bit_size = 0;
+	spec.padding = false;
+
+	if (count) {
+		if (Z_TYPE_P(count) == IS_ARRAY) {
+			zval *dim;
+			ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(count), dim) {
+				if (!add_dim(spec.dims, zval_get_long(dim), err))
+					return false;
+			} ZEND_HASH_FOREACH_END();
+		} else if (!add_dim(spec.dims, zval_get_long(count), err)) {
+			return false;
+		}
+	}
+
+	if (Z_TYPE_P(type) == IS_STRING) {
+		std::string tname(Z_STRVAL_P(type), Z_STRLEN_P(type));
+		if (tname == "pad") {
+			spec.type = make_scalar(TableSchema::KIND_BYTES, 1);
+			spec.padding = true;
+			if (spec.dims.empty())
+				spec.dims.push_back(1);
+			return true;
+		}
+		spec.type = type_with_dims(tname, spec.dims, err);
+	} else {
+		spec.type = type_from_zval(type, err);
+	}
+	return spec.type != nullptr;
+}
+
+std::shared_ptr<Type> type_from_zval(zval *spec, std::string &err) {
+	if (Z_TYPE_P(spec) != IS_ARRAY) {
+		err = "schema must be an array of fields";
+		return nullptr;
+	}
+
+	std::vector<FieldSpec> specs;
+	zval *entry;
+	ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(spec), entry) {
+		FieldSpec field;
+		if (!field_from_zval(entry, field, err))
+			return nullptr;
+		specs.push_back(std::move(field));
+	} ZEND_HASH_FOREACH_END();
+
+	return layout(specs, false, false, err);
+}
+
+uint64_t read_uint(const char *p, size_t size) {
+	uint64_t v = 0;
+	memcpy(&v, p, size > sizeof(v) ? sizeof(v) : size);
+	return v;
+}
+
+void decode_scalar(const Type &t, const char *p, zval *out) {
+	switch (t.kind) {
+		case TableSchema::KIND_INT: {
+			uint64_t v = read_uint(p, t.size);
+			int shift = 64 - (int) t.size * 8;
+			int64_t sv = shift > 0 ? ((int64_t) (v << shift)) >> shift : (int64_t) v;
+			ZVAL_LONG(out, (zend_long) sv);
+			break;
+		}
+		case TableSchema::KIND_UINT:
+			ZVAL_LONG(out, (zend_long) read_uint(p, t.size));
+			break;
+		case TableSchema::KIND_FLOAT:
+			if (t.size == sizeof(float)) {
+				float f;
+				memcpy(&f, p, sizeof(f));
+				ZVAL_DOUBLE(out, f);
+			} else {
+				double d;
+				memcpy(&d, p, sizeof(d));
+				ZVAL_DOUBLE(out, d);
+			}
+			break;
+		default:
+			ZVAL_STRINGL(out, p, t.size);
+			break;
+	}
+}
+
+void decode_type(const Type &t, const char *p, size_t avail, zval *out);
+
+void decode_record_into(const Type &t, const char *p, size_t avail, zval *out);
+
+void decode_array(const Type &t, const std::vector<size_t> &dims, size_t dim, const char *p, size_t avail,
+                  zval *out) {
+	size_t n = dims[dim];
+	size_t stride = t.size * element_count(std::vector<size_t>(dims.begin() + dim + 1, dims.end()));
+
+	if (dim + 1 == dims.size() && t.is_char) {
+		size_t len = std::min(n, avail);
+		ZVAL_STRINGL(out, p, strnlen(p, len));
+		return;
+	}
+
+	array_init_size(out, (uint32_t) n);
+	for (size_t i = 0; i < n; i++) {
+		zval item;
+		size_t off = i * stride;
+		if (off + stride > avail) {
+			ZVAL_NULL(&item);
+		} else if (dim + 1 < dims.size()) {
+			decode_array(t, dims, dim + 1, p + off, avail - off, &item);
+		} else {
+			decode_type(t, p + off, avail - off, &item);
+		}
+		add_next_index_zval(out, &item);
+	}
+}
+
+void decode_field(const Field &f, const char *base, size_t len, zval *out) {
+	const Type &t = *f.type;
+	if (f.offset >= len) {
+		ZVAL_NULL(out);
+		return;
+	}
+	const char *p = base + f.offset;
+	size_t avail = len - f.offset;
+
+	if (f.bit_size > 0) {
+		uint64_t v = read_uint(p, std::min(avail, sizeof(uint64_t)));
+		v >>= f.bit_offset;
+		if (f.bit_size < 64)
+			v &= (1ULL << f.bit_size) - 1;
+		if (t.kind == TableSchema::KIND_INT && f.bit_size < 64 && (v >> (f.bit_size - 1)) & 1)
+			v |= ~0ULL << f.bit_size;
+		ZVAL_LONG(out, (zend_long) v);
+		return;
+	}
+
+	if (!f.dims.empty()) {
+		decode_array(t, f.dims, 0, p, avail, out);
+		return;
+	}
+
+	if (t.size > avail) {
+		ZVAL_NULL(out);
+		return;
+	}
+	decode_type(t, p, avail, out);
+}
+
+void decode_record_into(const Type &t, const char *p, size_t avail, zval *out) {
+	for (const auto &f: t.fields) {
+		if (f.padding)
+			continue;
+		// Anonymous members are flattened into the enclosing record, as in C
+		if (f.name.empty() && f.type->kind == TableSchema::KIND_RECORD && f.dims.empty()) {
+			if (f.offset < avail)
+				decode_record_into(*f.type, p + f.offset, avail - f.offset, out);
+			continue;
+		}
+		zval value;
+		decode_field(f, p, avail, &value);
+		add_assoc_zval_ex(out, f.name.c_str(), f.name.size(), &value);
+	}
+}
+
+void decode_type(const Type &t, const char *p, size_t avail, zval *out) {
+	if (t.kind != TableSchema::KIND_RECORD) {
+		decode_scalar(t, p, out);
+		return;
+	}
+	array_init_size(out, (uint32_t) t.fields.size());
+	decode_record_into(t, p, avail, out);
+}
+
+void write_uint(char *p, size_t size, uint64_t v) {
+	memcpy(p, &v, size > sizeof(v) ? sizeof(v) : size);
+}
+
+bool encode_type(const Type &t, zval *in, char *p, size_t avail, std::string &err);
+
+bool encode_scalar(const Type &t, zval *in, char *p, std::string &err) {
+	switch (t.kind) {
+		case TableSchema::KIND_INT:
+		case TableSchema::KIND_UINT:
+			if (Z_TYPE_P(in) == IS_ARRAY || Z_TYPE_P(in) == IS_OBJECT) {
+				err = "expected an integer";
+				return false;
+			}
+			write_uint(p, t.size, (uint64_t) zval_get_long(in));
+			return true;
+		case TableSchema::KIND_FLOAT:
+			if (t.size == sizeof(float)) {
+				float f = (float) zval_get_double(in);
+				memcpy(p, &f, sizeof(f));
+			} else {
+				double d = zval_get_double(in);
+				memcpy(p, &d, sizeof(d));
+			}
+			return true;
+		default:
+			if (Z_TYPE_P(in) != IS_STRING) {
+				err = "expected a string";
+				return false;
+			}
+			memcpy(p, Z_STRVAL_P(in), std::min(t.size, (size_t) Z_STRLEN_P(in)));
+			return true;
+	}
+}
+
+bool encode_array(const Type &t, const std::vector<size_t> &dims, size_t dim, zval *in, char *p, size_t avail,
+                  std::string &err) {
+	size_t n = dims[dim];
+	size_t stride = t.size * element_count(std::vector<size_t>(dims.begin() + dim + 1, dims.end()));
+
+	if (dim + 1 == dims.size() && t.is_char && Z_TYPE_P(in) == IS_STRING) {
+		memcpy(p, Z_STRVAL_P(in), std::min(std::min(n, avail), (size_t) Z_STRLEN_P(in)));
+		return true;
+	}
+	if (Z_TYPE_P(in) != IS_ARRAY) {
+		err = "expected an array";
+		return false;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		size_t off = i * stride;
+		zval *item = zend_hash_index_find(Z_ARRVAL_P(in), i);
+		if (!item || off + stride > avail)
+			continue;
+		bool ok = dim + 1 < dims.size() ? encode_array(t, dims, dim + 1, item, p + off, avail - off, err)
+		                                : encode_type(t, item, p + off, avail - off, err);
+		if (!ok)
+			return false;
+	}
+	return true;
+}
+
+bool encode_field(const Field &f, zval *in, char *base, size_t len, std::string &err) {
+	const Type &t = *f.type;
+	if (f.offset >= len)
+		return true;
+	char *p = base + f.offset;
+	size_t avail = len - f.offset;
+
+	if (f.bit_size > 0) {
+		size_t n = std::min(avail, sizeof(uint64_t));
+		uint64_t mask = f.bit_size < 64 ? (1ULL << f.bit_size) - 1 : ~0ULL;
+		uint64_t v = read_uint(p, n);
+		v &= ~(mask << f.bit_offset);
+		v |= ((uint64_t) zval_get_long(in) & mask) << f.bit_offset;
+		write_uint(p, n, v);
+		return true;
+	}
+
+	if (!f.dims.empty())
+		return encode_array(t, f.dims, 0, in, p, avail, err);
+
+	if (t.size > avail)
+		return true;
+	return encode_type(t, in, p, avail, err);
+}
+
+bool encode_record_from(const Type &t, HashTable *ht, char *p, size_t avail, std::string &err) {
+	for (const auto &f: t.fields) {
+		if (f.padding)
+			continue;
+		if (f.name.empty() && f.type->kind == TableSchema::KIND_RECORD && f.dims.empty()) {
+			if (f.offset < avail && !encode_record_from(*f.type, ht, p + f.offset, avail - f.offset, err))
+				return false;
+			continue;
+		}
+		zval *value = zend_hash_str_find(ht, f.name.c_str(), f.name.size());
+		if (!value)
+			continue;
+		if (!encode_field(f, value, p, avail, err)) {
+			err = f.name + ": " + err;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool encode_type(const Type &t, zval *in, char *p, size_t avail, std::string &err) {
+	if (t.kind != TableSchema::KIND_RECORD)
+		return encode_scalar(t, in, p, err);
+	if (Z_TYPE_P(in) != IS_ARRAY) {
+		err = "expected an array";
+		return false;
+	}
+	return encode_record_from(t, Z_ARRVAL_P(in), p, avail, err);
+}
+
+}  // namespace
+
+TableSchema *TableSchema::from_desc(const std::string &desc, std::string &err) {
+	JsonNode root;
+	JsonParser parser(desc);
+	if (!parser.parse(root)) {
+		// Plain type names are not always quoted by older BCC releases
+		auto t = scalar_type(desc, err);
+		return t ? new TableSchema(t) : nullptr;
+	}
+	auto t = type_from_json(root, err);
+	return t ? new TableSchema(t) : nullptr;
+}
+
+TableSchema *TableSchema::from_perf_fields(const std::vector<std::string> &fields, std::string &err) {
+	if (fields.empty()) {
+		err = "no perf_submit() fields recorded for this table";
+		return nullptr;
+	}
+
+	std::vector<FieldSpec> specs;
+	for (const auto &field: fields) {
+		size_t sep = field.find('#');
+		if (sep == std::string::npos) {
+			err = "malformed perf event field '" + field + "'";
+			return nullptr;
+		}
+		FieldSpec spec;
+		spec.name = field.substr(0, sep);
+		spec.bit_size = 0;
+		spec.padding = false;
+		spec.type = type_with_dims(field.substr(sep + 1), spec.dims, err);
+		if (!spec.type)
+			return nullptr;
+		specs.push_back(std::move(spec));
+	}
+	auto t = layout(specs, false, false, err);
+	return t ? new TableSchema(t) : nullptr;
+}
+
+TableSchema *TableSchema::from_zval(zval *spec, std::string &err) {
+	if (Z_TYPE_P(spec) == IS_STRING)
+		return from_desc(std::string(Z_STRVAL_P(spec), Z_STRLEN_P(spec)), err);
+	auto t = type_from_zval(spec, err);
+	return t ? new TableSchema(t) : nullptr;
+}
+
+const TableSchema::Field *TableSchema::int_field(const std::string &name) const {
+	if (root_->kind != KIND_RECORD)
+		return nullptr;
+	for (const auto &f: root_->fields) {
+		if (f.name != name)
+			continue;
+		if ((f.type->kind != KIND_INT && f.type->kind != KIND_UINT) || !f.dims.empty() ||
+		    f.bit_size > 0 || f.type->size > 8)
+			return nullptr;
+		return &f;
+	}
+	return nullptr;
+}
+
+void TableSchema::decode(const char *data, size_t len, zval *out) const {
+	if (root_->size > len && root_->kind != KIND_RECORD) {
+		ZVAL_NULL(out);
+		return;
+	}
+	decode_type(*root_, data, len, out);
+}
+
+bool TableSchema::encode(zval *in, char *out, size_t len, std::string &err) const {
+	if (root_->size > len) {
+		err = "record is " + std::to_string(root_->size) + " bytes but only " + std::to_string(len) + " are available";
+		return false;
+	}
+	return encode_type(*root_, in, out, len, err);
+}
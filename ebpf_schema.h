@@ -0,0 +1,135 @@
+/*
+  +----------------------------------------------------------------------+
+  | PHP Version 7, 8                                                     |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 1997-2018 The PHP Group                                |
+  +----------------------------------------------------------------------+
+  | This source file is subject to version 3.01 of the PHP license,      |
+  | that is bundled with this package in the file LICENSE, and is        |
+  | available through the world-wide-web at the following url:           |
+  | http://www.php.net/license/3_01.txt                                  |
+  | If you did not receive a copy of the PHP license and are unable to   |
+  | obtain it through the world-wide-web, please send a note to          |
+  | license@php.net so we can mail you a copy immediately.               |
+  +----------------------------------------------------------------------+
+  | Author: carl.guo a631929063@gmail.com                                |
+  +----------------------------------------------------------------------+
+*/
+
+#ifndef EBPF_SCHEMA_H
+#define EBPF_SCHEMA_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Binary layout of a BPF key, leaf or perf event record
+ *
+ * A schema is built once, either from the type descriptors BCC attaches to
+ * every table (bpf_table_key_desc / bpf_table_leaf_desc), from the fields
+ * recorded for a perf_submit() call, or from a field list declared in PHP.
+ * It then decodes raw records straight into PHP values.
+ */
+class TableSchema {
+public:
+	enum Kind {
+		KIND_INT,
+		KIND_UINT,
+		KIND_FLOAT,
+		KIND_BYTES,
+		KIND_RECORD
+	};
+
+	struct Type;
+
+	struct Field {
+		std::string name;
+		std::shared_ptr<Type> type;
+		size_t offset;
+		std::vector<size_t> dims;
+		int bit_offset;
+		int bit_size;
+		bool padding;
+	};
+
+	struct Type {
+		Kind kind;
+		size_t size;
+		size_t align;
+		bool is_char;
+		std::vector<Field> fields;
+	};
+
+	/**
+	 * @brief Build a schema from a BCC table descriptor (JSON)
+	 * @param desc Descriptor as returned by bpf_table_key_desc/bpf_table_leaf_desc
+	 * @param err Receives the reason on failure
+	 * @return Schema, or nullptr on failure
+	 */
+	static TableSchema *from_desc(const std::string &desc, std::string &err);
+
+	/**
+	 * @brief Build a schema from the "name#type" fields BCC records for perf_submit()
+	 * @param fields Field list as returned by bpf_perf_event_field
+	 * @param err Receives the reason on failure
+	 * @return Schema, or nullptr on failure
+	 */
+	static TableSchema *from_perf_fields(const std::vector<std::string> &fields, std::string &err);
+
+	/**
+	 * @brief Build a schema from a PHP field list
+	 *
+	 * Each entry is [name, type] or [name, type, count]. type is a C type name
+	 * ("u32", "unsigned long long", "char", ...), "pad" for explicit padding
+	 * bytes, or a nested field list. A string is parsed as a BCC descriptor.
+	 *
+	 * @param spec PHP array or string
+	 * @param err Receives the reason on failure
+	 * @return Schema, or nullptr on failure
+	 */
+	static TableSchema *from_zval(zval *spec, std::string &err);
+
+	/**
+	 * @brief Size in bytes of one record described by this schema
+	 */
+	size_t size() const { return root_->size; }
+
+	/**
+	 * @brief Kind of the top-level type, KIND_RECORD for structs and unions
+	 */
+	Kind kind() const { return root_->kind; }
+
+	/**
+	 * @brief Find a top-level integer field of a record by name
+	 * @return The field, or nullptr if the schema is not a record or the
+	 *         field is missing, an array, a bitfield or wider than 8 bytes
+	 */
+	const Field *int_field(const std::string &name) const;
+
+	/**
+	 * @brief Decode one record into a PHP value
+	 *
+	 * Records are decoded to associative arrays, scalars to int/float, char
+	 * arrays to strings cut at the first NUL. Fields beyond len decode to null.
+	 */
+	void decode(const char *data, size_t len, zval *out) const;
+
+	/**
+	 * @brief Encode a PHP value into one record, the inverse of decode()
+	 *
+	 * out must hold len zeroed bytes. Record fields missing from the array stay
+	 * zero, strings longer than a char array are truncated.
+	 *
+	 * @param err Receives the reason on failure
+	 * @return false if the value does not match the layout
+	 */
+	bool encode(zval *in, char *out, size_t len, std::string &err) const;
+
+private:
+	explicit TableSchema(std::shared_ptr<Type> root) : root_(std::move(root)) {}
+
+	std::shared_ptr<Type> root_;
+};
+
+#endif    /* EBPF_SCHEMA_H */
@@ -75,7 +75,8 @@ function decimal_to_ip($int) {
 while (true) {
     sleep(OUTPUT_INTERVAL);
 
-    $items = $packet_cnt->values();
+    # read and reset the counters in one pass, nothing is lost in between
+    $items = $packet_cnt->drain();
     $time = date("Y-m-d H:i:s");
 
     if (count($items) > 0) {
@@ -97,6 +98,4 @@ while (true) {
             $time
         );
     }
-
-    $packet_cnt->clear();
 }
@@ -0,0 +1,54 @@
+<?php
+#
+# bitehist_disks.php	Block I/O size histogram per disk.
+#		For Linux, uses BCC, eBPF. Embedded C.
+#
+# Like bitehist.php, but the histogram is keyed by {disk, slot} and
+# printed one section per disk, as biolatency -D does.
+#
+# A Ctrl-C will print the gathered histograms then exit.
+
+$bpf_text = <<<EOT
+#include <uapi/linux/ptrace.h>
+#include <linux/blk-mq.h>
+#include <linux/blkdev.h>
+
+typedef struct disk_key {
+    char disk[DISK_NAME_LEN];
+    u64 slot;
+} disk_key_t;
+
+BPF_HISTOGRAM(dist, disk_key_t);
+
+int trace_req_done(struct pt_regs *ctx, struct request *req)
+{
+    disk_key_t key = {};
+    bpf_probe_read_kernel(&key.disk, sizeof(key.disk), req->q->disk->disk_name);
+    key.slot = bpf_log2l(req->__data_len / 1024);
+    dist.increment(key);
+    return 0;
+}
+EOT;
+
+# load BPF program
+$b = new Bpf(["text" => $bpf_text]);
+$b->attach_kprobe("blk_mq_end_request", "trace_req_done");
+
+echo "Tracing... Hit Ctrl-C to end.\n";
+
+pcntl_signal(SIGINT, "signalHandler");
+pcntl_async_signals(true);
+
+while (true) {
+    sleep(99999999);
+}
+
+function signalHandler($signo) {
+    global $b;
+    switch ($signo) {
+        case SIGINT:
+            # one map dump, grouped by disk natively
+            $b->dist->print_log2_hist("kbytes", "disk");
+            exit(0);
+    }
+}
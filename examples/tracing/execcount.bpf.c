@@ -0,0 +1,32 @@
+// Build with:
+//   bpftool btf dump file /sys/kernel/btf/vmlinux format c > vmlinux.h
+//   clang -O2 -g -target bpf -c execcount.bpf.c -o execcount.bpf.o
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+
+struct key_t {
+    char comm[16];
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 10240);
+    __type(key, struct key_t);
+    __type(value, u64);
+} counts SEC(".maps");
+
+SEC("tracepoint/syscalls/sys_enter_execve")
+int count_exec(void *ctx) {
+    struct key_t key = {};
+    u64 one = 1, *val;
+
+    bpf_get_current_comm(&key.comm, sizeof(key.comm));
+    val = bpf_map_lookup_elem(&counts, &key);
+    if (val)
+        __sync_fetch_and_add(val, 1);
+    else
+        bpf_map_update_elem(&counts, &key, &one, BPF_NOEXIST);
+    return 0;
+}
+
+char LICENSE[] SEC("license") = "GPL";
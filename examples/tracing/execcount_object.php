@@ -0,0 +1,28 @@
+<?php
+# Loads execcount.bpf.o, built ahead of time (see execcount.bpf.c), so no
+# clang, LLVM or kernel headers are needed on the host running this script.
+$object = __DIR__ . "/execcount.bpf.o";
+if (!file_exists($object)) {
+    die("USAGE: build $object first, see execcount.bpf.c\n");
+}
+
+# programs are loaded and attached from their SEC() names
+$b = new Bpf(["object" => $object]);
+
+# key and value layouts come from the BTF of the map
+$counts = $b->counts;
+$counts->set_schema();
+
+echo "Counting execve() by command... Hit Ctrl-C to end.\n";
+
+while (true) {
+    sleep(1);
+    $entries = $counts->values();
+    usort($entries, function ($a, $b) {
+        return $b['value'] - $a['value'];
+    });
+    printf("\n%-16s %s\n", "COMM", "EXECS");
+    foreach (array_slice($entries, 0, 10) as $entry) {
+        printf("%-16s %d\n", $entry['key']['comm'], $entry['value']);
+    }
+}
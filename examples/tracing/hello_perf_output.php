@@ -32,9 +32,8 @@ printf("%-18s %-16s %-6s %s\n", "TIME(s)", "COMM", "PID", "MESSAGE");
 
 # process event
 $start = 0;
-function print_event($cpu, $data, $size) {
+function print_event($cpu, $event, $size) {
     global $start;
-    $event = unpack("Qpid/Qts/A16comm", $data);
     if ($start == 0) {
         $start = $event['ts'];
     }
@@ -42,7 +41,8 @@ function print_event($cpu, $data, $size) {
     printf("%-18.9f %-16s %-6d %s\n", $time_s, $event['comm'], $event['pid'], "Hello, perf_output!");
 }
 
-# loop with callback to print_event
+# loop with callback to print_event, events arrive decoded as struct data_t
+$b->events->set_schema();
 $b->events->open_perf_buffer("print_event");
 
 while (true) {
@@ -0,0 +1,54 @@
+<?php
+$prog = <<<EOT
+#include <linux/sched.h>
+
+// define output data structure in C
+struct data_t {
+    u32 pid;
+    u64 ts;
+    char comm[TASK_COMM_LEN];
+};
+BPF_RINGBUF_OUTPUT(events, 8);
+
+int hello(struct pt_regs *ctx) {
+    struct data_t data = {};
+
+    data.pid = bpf_get_current_pid_tgid();
+    data.ts = bpf_ktime_get_ns();
+    bpf_get_current_comm(&data.comm, sizeof(data.comm));
+
+    events.ringbuf_output(&data, sizeof(data), 0);
+
+    return 0;
+}
+EOT;
+
+# load BPF program
+$b    = new Bpf(["text" => $prog]);
+$b->attach_kprobe($b->get_syscall_fnname("clone"), "hello");
+
+# header
+printf("%-18s %-16s %-6s %s\n", "TIME(s)", "COMM", "PID", "MESSAGE");
+
+# process event
+$start = 0;
+function print_event($ctx, $event, $size) {
+    global $start;
+    if ($start == 0) {
+        $start = $event['ts'];
+    }
+    $time_s = ($event['ts'] - $start) / 1000000000.0;
+    printf("%-18.9f %-16s %-6d %s\n", $time_s, $event['comm'], $event['pid'], "Hello, ringbuf_output!");
+}
+
+# one ring buffer shared by all CPUs, events arrive decoded as struct data_t
+$b->events->set_schema();
+$b->events->open_ring_buffer("print_event");
+
+while (true) {
+    try {
+        $b->ring_buffer_poll(100);
+    } catch (Exception $e) {
+        exit();
+    }
+}
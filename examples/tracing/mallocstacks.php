@@ -63,6 +63,9 @@ function signalHandler($signo)
                 return ($first['value'] < $sec['value']) ? 1 : -1;
             });
 
+            # resolve all stacks at once, each distinct address only once
+            $stack_frames = $stack_traces->values_many(array_column($mapped, 'stack_id'), $pid);
+
             foreach ($mapped as $entry) {
                 $stack_id = $entry['stack_id'];
                 $value = $entry['value'];
@@ -70,7 +73,7 @@ function signalHandler($signo)
                 printf("%d bytes allocated at:\n", $value);
 
                 if ($stack_id > 0) {
-                    $stack = $stack_traces->values($stack_id, $pid);
+                    $stack = $stack_frames[$stack_id];
                     foreach ($stack as $addr) {
                         printf("\t%s\n", $addr);
                     }
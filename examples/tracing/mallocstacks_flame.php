@@ -0,0 +1,56 @@
+<?php
+if ($argc < 3) {
+    echo "USAGE: mallocstacks_flame PID OUTPUT [folded|pprof]\n";
+    exit(1);
+}
+$pid    = (int)$argv[1];
+$output = $argv[2];
+$format = $argc > 3 ? $argv[3] : "folded";
+
+$bpf_text = <<<EOT
+#include <uapi/linux/ptrace.h>
+
+BPF_HASH(calls, int);
+BPF_STACK_TRACE(stack_traces, 16384);
+
+int alloc_enter(struct pt_regs *ctx, size_t size) {
+    int key = stack_traces.get_stackid(ctx, BPF_F_USER_STACK);
+    if (key < 0)
+        return 0;
+
+    u64 zero = 0, *val;
+    val = calls.lookup_or_try_init(&key, &zero);
+    if (val) {
+      (*val) += size;
+    }
+    return 0;
+};
+EOT;
+
+$ebpf = new Bpf(["text" => $bpf_text]);
+$ebpf->attach_uprobe("c", "malloc", "alloc_enter", ["pid" => $pid]);
+echo "Attaching to malloc in pid {$pid}, Ctrl+C to write {$output}.\n";
+
+pcntl_signal(SIGINT, "signalHandler");
+pcntl_async_signals(true);
+
+while (true) {
+    sleep(99999999);
+}
+
+function signalHandler($signo)
+{
+    global $ebpf, $pid, $output, $format;
+    if ($signo != SIGINT) {
+        return;
+    }
+    # join counts and stacks natively, e.g. for flamegraph.pl or go tool pprof
+    $n = $ebpf->stack_traces->export_profile($ebpf->calls, $output, [
+        "format"      => $format,
+        "pid"         => $pid,
+        "sample_type" => "alloc_space",
+        "unit"        => "bytes",
+    ]);
+    echo "\n{$n} stacks written to {$output}\n";
+    exit(0);
+}
@@ -0,0 +1,49 @@
+<?php
+$bpf_text = <<<EOT
+#include <uapi/linux/ptrace.h>
+
+// PIDs to trace, maintained from PHP
+BPF_HASH(filter, u32, u8);
+BPF_HASH(counts, u32, u64);
+
+int count_open(struct pt_regs *ctx) {
+    u32 pid = bpf_get_current_pid_tgid() >> 32;
+    if (!filter.lookup(&pid))
+        return 0;
+    counts.increment(pid);
+    return 0;
+}
+EOT;
+
+if ($argc < 2) {
+    die("USAGE: php pid_filter.php PID [PID ...]\n");
+}
+
+$b = new Bpf(["text" => $bpf_text]);
+$b->attach_kprobe($b->get_syscall_fnname("openat"), "count_open");
+
+# one syscall per PID, no dump of the map needed
+$filter = $b->get_table("filter");
+$pids = array_map('intval', array_slice($argv, 1));
+$filter->set_many($pids, array_fill(0, count($pids), "\x01"));
+
+$counts = $b->get_table("counts");
+echo "Counting openat() for PIDs " . implode(", ", $pids) . "... Hit Ctrl-C to end.\n";
+
+while (true) {
+    sleep(1);
+    foreach ($pids as $i => $pid) {
+        if (!file_exists("/proc/$pid")) {
+            # stop tracing PIDs that are gone
+            $filter->delete($pid);
+            $counts->delete($pid);
+            unset($pids[$i]);
+            continue;
+        }
+        $n = $counts->get($pid);
+        printf("%-8d %d\n", $pid, $n === null ? 0 : unpack("Q", $n)[1]);
+    }
+    if (!$pids) {
+        exit(0);
+    }
+}
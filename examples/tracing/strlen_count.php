@@ -43,11 +43,14 @@ function signalHandler($signo)
         case SIGINT:
             echo sprintf("%10s %s\n", "COUNT", "STRING");
             $counts        = $b->get_table("counts");
-            $vals = $counts->values();
-            foreach ($vals as $v) {
-                $k = unpack("A80c", $v['key']);
-                $v = unpack("Qval", $v['value']);
-                printf("%10d \"%s\"\n", $v['val'],$k['c']);
+            # all keys and all values as two packed blobs, decoded in one go each
+            $packed = $counts->values_packed();
+            if ($packed['count'] > 0) {
+                $keys = str_split($packed['keys'], $packed['key_size']);
+                $vals = array_values(unpack("Q*", $packed['values']));
+                foreach ($keys as $i => $k) {
+                    printf("%10d \"%s\"\n", $vals[$i], rtrim($k, "\0"));
+                }
             }
             exit(0);
     }
@@ -23,6 +23,8 @@
 
 #include <iostream>
 #include <unordered_set>
+#include <map>
+#include <vector>
 
 extern zend_module_entry ebpf_module_entry;
 #define phpext_ebpf_ptr &ebpf_module_entry
@@ -69,37 +71,126 @@ const std::vector<std::string> syscall_prefixes = {
 
 void callbackfn(void *cookie, void *data, int data_size);
 
+void lostcbfn(void *cookie, uint64_t lost);
+
+/**
+ * @brief Native accumulator for a perf buffer opened in batch mode
+ *
+ * Samples read during one poll are appended to events and handed to the
+ * PHP callback as a single array, either when max_size is reached or
+ * when the poll returns. max_size is at most PERF_BUFFER_MAX_BATCH_SIZE;
+ * events starts at PERF_BUFFER_BATCH_INIT_SIZE buckets and grows as needed.
+ */
+#define PERF_BUFFER_MAX_BATCH_SIZE (1 << 20)
+#define PERF_BUFFER_BATCH_INIT_SIZE 64
+
+typedef struct _perf_buffer_batch {
+	zend_long max_size;
+	zval events;
+} perf_buffer_batch;
+
+struct _sub_object;
+
 class EbpfExtension {
 private:
-	void *mod;
+	/**
+	 * @brief bcc symbol caches by pid, -1 for the kernel
+	 *
+	 * Loading the ELF symbols of a process is the expensive part of resolving
+	 * a stack, so the caches live as long as the Bpf object and are shared by
+	 * every StackTraceTable it hands out.
+	 */
+	std::map<int, void *> _symcaches;
 
 public:
-	zval _class_perf_event_obj;
+	/**
+	 * @brief Table objects by name, created on first access and reused after
+	 *
+	 * Perf event array and ring buffer tables are also the cookie of their
+	 * opened buffers. The cache keeps them alive while the Bpf object is;
+	 * tables still held when it is destroyed keep it alive in turn.
+	 */
+	zval _tables;
+
+	/**
+	 * @brief Table objects with an opened perf or ring buffer
+	 *
+	 * Not owning: a table removes itself when it is freed. Polls flush from
+	 * here rather than walking _tables, which callbacks may add to.
+	 */
+	std::vector<struct _sub_object *> _buffers;
+
+	/**
+	 * @brief Every table object handed out, cached or not
+	 *
+	 * Not owning: a table removes itself when it is freed. The cycle
+	 * collector may free the Bpf object first, which detaches whatever is
+	 * left here from the native state.
+	 */
+	std::vector<struct _sub_object *> _wrappers;
 	ebpf::BPF bpf;
 
 	/**
 	 * @brief Default constructor for EbpfExtension
 	 */
 	EbpfExtension() {
-		ZVAL_UNDEF(&_class_perf_event_obj);
+		array_init(&_tables);
 	};
 
 	/**
 	 * @brief Virtual destructor for EbpfExtension
 	 */
 	virtual ~EbpfExtension() {
-		if (Z_TYPE(_class_perf_event_obj) != IS_UNDEF) {
-			zval_ptr_dtor(&_class_perf_event_obj);
-		}
+		invalidate_symcaches();
+		zval_ptr_dtor(&_tables);
 	};
 
-	ebpf::StatusTuple init(const std::string &bpf_program) {
-		auto res = this->bpf.init(bpf_program);
-		if (res.code() == 0)
-			this->mod = (void *) this->bpf.get_mod();
-		return res;
+	/**
+	 * @brief Whether init() loaded the program from the compiled program cache
+	 */
+	bool _from_cache = false;
+
+	/**
+	 * @brief Compile and load a BPF program
+	 *
+	 * With a cache directory, the compiled image is looked up by program
+	 * text, cflags, kernel release and kernel headers before running
+	 * clang/LLVM, and stored there after a successful compile. The
+	 * directory is created if needed and refused unless it belongs to the
+	 * effective user and is not writable by group or others; entries that
+	 * fail the same check are ignored.
+	 *
+	 * @param bpf_program Program source
+	 * @param cflags Extra compiler flags
+	 * @param cache_dir Compiled program cache directory, empty to always compile
+	 */
+	ebpf::StatusTuple init(const std::string &bpf_program, const std::vector<std::string> &cflags = {},
+	                       const std::string &cache_dir = "");
+
+	/**
+	 * @brief Load a precompiled BPF ELF object (libbpf CO-RE), no compiler involved
+	 * @param path Path of the .bpf.o file
+	 */
+	ebpf::StatusTuple init_object(const std::string &path) {
+		_from_cache = false;
+		return bpf.init_object(path);
 	}
 
+	/**
+	 * @brief Bytes of resident memory given back by free_bcc_memory() so far
+	 */
+	size_t _bcc_memory_reclaimed = 0;
+
+	/**
+	 * @brief Release the LLVM/Clang state bcc keeps after compiling, then trim the heap
+	 *
+	 * Functions are loaded from the bytecode kept by the module, so attaching
+	 * programs afterwards still works.
+	 *
+	 * @param reclaimed Receives the drop in resident memory, in bytes
+	 */
+	ebpf::StatusTuple free_bcc_memory(size_t &reclaimed);
+
 	/**
 	 * @brief Add a prefix to a function name
 	 * @param prefix The prefix to add
@@ -121,6 +212,18 @@ public:
 	 */
 	void _trace_autoload();
 
+	/**
+	 * @brief Attach an object program by its libbpf section name
+	 *
+	 * Handles kprobe/, kretprobe/, tracepoint/ (tp/), raw_tracepoint/ (raw_tp/),
+	 * fentry/, fexit/ and lsm/ sections; other programs are left for the
+	 * explicit attach methods.
+	 *
+	 * @param fn_name Program name
+	 * @param section ELF section of the program
+	 */
+	void _section_autoload(const std::string &fn_name, const std::string &section);
+
 	/**
 	 * @brief Get kprobe functions matching a regular expression
 	 * @param event_re Regular expression to match function names
@@ -143,12 +246,51 @@ public:
 	ebpf::StatusTuple attach_lsm(const std::string &lsm);
 
 	/**
-	 * @brief Get a BPF table class
+	 * @brief Get a BPF table class, cached per table name
+	 * @param parent Bpf object owning this extension
 	 * @param table_name Name of the BPF table
 	 * @param from_attr Attribute to get from the table
-	 * @return The table class object
+	 * @return The table class object, owning one reference
+	 */
+	zval get_table_cls(zend_object *parent, const char *table_name, int from_attr);
+
+	/**
+	 * @brief Get the symbol cache of a process, creating it on first use
+	 * @param pid Process id, or -1 for kernel symbols
+	 * @return bcc symcache handle
+	 */
+	void *symcache(int pid);
+
+	/**
+	 * @brief Resolve stack addresses to symbol names through the cached symbols
+	 * @param addrs Instruction pointers, innermost frame first
+	 * @param pid Process id, or -1 for kernel stacks
+	 * @return One name per address, "[UNKNOWN]" when it cannot be resolved
+	 */
+	std::vector<std::string> resolve_stack(const std::vector<uintptr_t> &addrs, int pid);
+
+	/**
+	 * @brief Drop the symbol cache of a process, it is rebuilt on next use
+	 * @param pid Process id, or -1 for kernel symbols
+	 */
+	void invalidate_symcache(int pid);
+
+	/**
+	 * @brief Drop every symbol cache
+	 */
+	void invalidate_symcaches();
+
+	/**
+	 * @brief Reload the module list of a cached process, e.g. after dlopen()
+	 * @param pid Process id, or -1 for kernel symbols
+	 * @return false if no cache exists for pid
+	 */
+	bool refresh_symcache(int pid);
+
+	/**
+	 * @brief Reload the module list of every cached process
 	 */
-	zval get_table_cls(const char *table_name, int from_attr);
+	void refresh_symcaches();
 };
 
 class BPFProgType {
@@ -0,0 +1,89 @@
+--TEST--
+Histogram buckets, percentiles and merge
+--SKIPIF--
+<?php if (!extension_loaded("ebpf")) print "skip"; ?>
+--FILE--
+<?php
+function dump_buckets($label, Histogram $h) {
+	echo $label, ":";
+	foreach ($h->buckets() as $b) {
+		echo " {$b['low']}-{$b['high']}={$b['count']}";
+	}
+	echo "\n";
+}
+
+// Slot 0 holds 0, slot i holds [2^(i-1), 2^i - 1]; trailing empty slots are dropped
+$log2 = Histogram::log2([0, 2, 3, 0, 5, 0, 0]);
+dump_buckets("log2", $log2);
+echo "total: ", $log2->total(), "\n";
+foreach ([0, 25, 50, 90, 100] as $p) {
+	printf("p%s: %.3f\n", $p, $log2->percentile($p));
+}
+
+$linear = Histogram::linear([3, 0, 1], 10);
+dump_buckets("linear", $linear);
+foreach ($linear->percentiles([50, 99.9, 9.99]) as $key => $value) {
+	printf("%s: %.3f\n", $key, $value);
+}
+
+$empty = Histogram::log2([]);
+dump_buckets("empty", $empty);
+echo "empty total: ", $empty->total(), "\n";
+var_dump($empty->percentile(50));
+var_dump($empty->percentiles());
+
+// Equal bounds are summed
+dump_buckets("same bounds", Histogram::linear([1, 2], 10)->merge(Histogram::linear([3, 4], 10)));
+// Empty buckets give way to overlapping ones, disjoint ones sit side by side
+dump_buckets("disjoint", Histogram::linear([0, 0, 4], 100)->merge(Histogram::linear([7], 50)));
+
+$base = Histogram::linear([3], 10);
+try {
+	$base->merge(Histogram::log2([0, 2]));
+} catch (Error $e) {
+	echo $e->getMessage(), "\n";
+}
+dump_buckets("unchanged", $base);
+
+try {
+	Histogram::log2([-1]);
+} catch (Error $e) {
+	echo $e->getMessage(), "\n";
+}
+try {
+	$log2->percentile(101);
+} catch (Error $e) {
+	echo $e->getMessage(), "\n";
+}
+?>
+--EXPECT--
+log2: 0-0=0 1-1=2 2-3=3 4-7=0 8-15=5
+total: 10
+p0: 1.000
+p25: 2.333
+p50: 3.000
+p90: 14.400
+p100: 15.000
+linear: 0-9=3 10-19=0 20-29=1
+p50: 6.667
+p99.9: 29.000
+p9.99: 1.332
+empty:
+empty total: 0
+NULL
+array(4) {
+  ["p50"]=>
+  NULL
+  ["p90"]=>
+  NULL
+  ["p99"]=>
+  NULL
+  ["p99.9"]=>
+  NULL
+}
+same bounds: 0-9=4 10-19=6
+disjoint: 0-49=7 100-199=0 200-299=4
+Cannot merge histograms: bucket 0-9 overlaps bucket 1-1
+unchanged: 0-9=3
+Histogram slot 0 has a negative count
+Percentile must be between 0 and 100
@@ -0,0 +1,119 @@
+--TEST--
+Profile folded stacks and pprof encoding
+--SKIPIF--
+<?php if (!extension_loaded("ebpf")) print "skip"; ?>
+--FILE--
+<?php
+function pb_varint($data, &$pos) {
+	$value = 0;
+	$shift = 0;
+	do {
+		$byte = ord($data[$pos++]);
+		$value |= ($byte & 0x7f) << $shift;
+		$shift += 7;
+	} while ($byte >= 0x80);
+	return $value;
+}
+
+// [field, value] pairs of one message; length-delimited values stay strings
+function pb_fields($data) {
+	$fields = [];
+	$pos = 0;
+	while ($pos < strlen($data)) {
+		$tag = pb_varint($data, $pos);
+		if (($tag & 7) == 0) {
+			$value = pb_varint($data, $pos);
+		} else {
+			$len = pb_varint($data, $pos);
+			$value = (string) substr($data, $pos, $len);
+			$pos += $len;
+		}
+		$fields[] = [$tag >> 3, $value];
+	}
+	return $fields;
+}
+
+function pb_message($data) {
+	$message = [];
+	foreach (pb_fields($data) as list($field, $value)) {
+		$message[$field] = $value;
+	}
+	return $message;
+}
+
+function pb_packed($data) {
+	$values = [];
+	$pos = 0;
+	while ($pos < strlen($data)) {
+		$values[] = pb_varint($data, $pos);
+	}
+	return implode(",", $values);
+}
+
+$p = new Profile();
+echo "empty: ", var_export($p->folded(), true), "\n";
+
+// Frames are innermost first; identical stacks are summed
+$p->add(["inner", "mid", "main"], 3);
+$p->add(["leaf", "mid", "main"], 2);
+$p->add(["inner", "mid", "main"], 4);
+echo "size: ", $p->size(), "\n";
+echo $p->folded();
+
+$strings = [];
+foreach (pb_fields($p->pprof("alloc_space", "bytes")) as list($field, $value)) {
+	switch ($field) {
+		case 1:
+			$m = pb_message($value);
+			echo "sample_type: type={$m[1]} unit={$m[2]}\n";
+			break;
+		case 2:
+			$m = pb_message($value);
+			echo "sample: locations=", pb_packed($m[1]), " value=", pb_packed($m[2]), "\n";
+			break;
+		case 4:
+			$m = pb_message($value);
+			$line = pb_message($m[4]);
+			echo "location: id={$m[1]} function={$line[1]}\n";
+			break;
+		case 5:
+			$m = pb_message($value);
+			echo "function: id={$m[1]} name={$m[2]} system_name={$m[3]}\n";
+			break;
+		case 6:
+			$strings[] = $value;
+			break;
+	}
+}
+echo "strings: ", implode("|", $strings), "\n";
+
+try {
+	$p->add(["main", 42], 1);
+} catch (Error $e) {
+	echo $e->getMessage(), "\n";
+}
+try {
+	$p->add([], 1);
+} catch (Error $e) {
+	echo $e->getMessage(), "\n";
+}
+?>
+--EXPECT--
+empty: ''
+size: 2
+main;mid;inner 7
+main;mid;leaf 2
+sample_type: type=5 unit=6
+sample: locations=1,2,3 value=7
+sample: locations=4,2,3 value=2
+location: id=1 function=1
+function: id=1 name=1 system_name=1
+location: id=2 function=2
+function: id=2 name=2 system_name=2
+location: id=3 function=3
+function: id=3 name=3 system_name=3
+location: id=4 function=4
+function: id=4 name=4 system_name=4
+strings: |inner|mid|main|leaf|alloc_space|bytes
+Frames must be strings
+A stack needs at least one frame
@@ -0,0 +1,43 @@
+--TEST--
+Tables outliving their Bpf through a collected cycle
+--SKIPIF--
+<?php
+if (!extension_loaded("ebpf")) print "skip";
+elseif (!function_exists("posix_geteuid") || posix_geteuid() != 0) print "skip needs root";
+?>
+--INI--
+error_reporting=E_ALL & ~E_DEPRECATED
+--FILE--
+<?php
+$prog = "BPF_ARRAY(counts, u64, 4);";
+
+// The table only leaves the cache as the Bpf is destroyed, then the cycle
+// collector frees both in whatever order it likes
+$b = new Bpf(["text" => $prog]);
+$b->t = $b->counts;
+unset($b);
+gc_collect_cycles();
+echo "cycle collected\n";
+
+// The Bpf also reachable from itself
+$b = new Bpf(["text" => $prog]);
+$b->t = $b->counts;
+$b->self = $b;
+unset($b);
+gc_collect_cycles();
+echo "self reference collected\n";
+
+// A table held from outside keeps its Bpf usable
+$b = new Bpf(["text" => $prog]);
+$t = $b->counts;
+unset($b);
+gc_collect_cycles();
+var_dump($t->get_value(0));
+unset($t);
+echo "done\n";
+?>
+--EXPECT--
+cycle collected
+self reference collected
+int(0)
+done
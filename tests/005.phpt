@@ -0,0 +1,41 @@
+--TEST--
+set_schema() rejects malformed descriptors
+--SKIPIF--
+<?php
+if (!extension_loaded("ebpf")) print "skip";
+elseif (!function_exists("posix_geteuid") || posix_geteuid() != 0) print "skip needs root";
+?>
+--FILE--
+<?php
+$b = new Bpf(["text" => "BPF_HASH(h, u32, u64);"]);
+$h = $b->h;
+
+$descs = [
+	'["v", [["f", "u32", 3], ["g", "u32", 29]], "struct"]',
+	'["v", [["f", ["r", [], "struct"], 3]], "struct"]',
+	'["v", [["f", "double", 3]], "struct"]',
+	'["v", [["f", "u8", 9]], "struct"]',
+	'["v", [["f", "u8", 0]], "struct"]',
+	'["v", [["f", "u8", -1]], "struct"]',
+	'["v", [["f", "u8", 4294967299]], "struct"]',
+	'["v", [["a", "int", [0]]], "struct"]',
+	'["v", [["a", "long long", [1048576, 1048576]]], "struct"]',
+];
+foreach ($descs as $desc) {
+	try {
+		var_dump($h->set_schema($desc));
+	} catch (Error $e) {
+		echo $e->getMessage(), "\n";
+	}
+}
+?>
+--EXPECT--
+bool(true)
+set_schema error: bitfield 'f' must have an integer type
+set_schema error: bitfield 'f' must have an integer type
+set_schema error: bitfield 'f' width 9 out of range 1..8
+set_schema error: bitfield 'f' width 0 out of range 1..8
+set_schema error: bitfield 'f' width -1 out of range 1..8
+set_schema error: bitfield 'f' width 4294967299 out of range 1..8
+set_schema error: array count 0 out of range 1..1048576
+set_schema error: array field larger than 16777216 bytes